@@ -11,136 +11,374 @@
 \******************************************************************************/
 
 #include "log.h"
+#include "os.h"
 #include "Config.h"
 
 namespace dragoon {
 
-Config::Node::~Node() {
-  delete child_;
-  delete next_;
+namespace {
+
+  // Character classes for the scanner
+  enum {
+    CLASS_SPACE = 1, // Separates tokens
+    CLASS_STOP = 2,  // Ends a word
+    CLASS_SLOW = 4,  // Needs the word to be compacted
+  };
+
+  struct Classes {
+    unsigned char c[256];
+    Classes() {
+      memset(c, 0, sizeof(c));
+      c[(int)' '] = c[(int)'\t'] = CLASS_SPACE | CLASS_STOP;
+      c[(int)'\n'] = c[(int)'{'] = c[(int)'}'] = c[(int)'#'] = CLASS_STOP;
+      c[(int)'\\'] = c[(int)'\r'] = CLASS_SLOW;
+    }
+    int operator[](char ch) const { return c[(unsigned char)ch]; }
+  } classes$;
+
+  // Smallest arena block. The first block is sized from the file so most
+  // configuration files fit in one.
+  const size_t arena_block$ = 4096;
 }
 
-char Config::Node::Getch(FILE* f, int& line) {
-  int ch;
+/** Tokenizer that works in place on a writable buffer. Words are
+    terminated by overwriting the character after them, or compacted
+    toward their start when they contain escapes. */
+class Config::Scanner {
+public:
+  Scanner(char* begin, char* end, Config& config):
+    p_(begin), end_(end), config_(config), pending_(0), line_(1) {}
 
-  // Skip windows carriage returns
-  do {
-    ch = fgetc(f);
+  /** Read the next token. Returns '{', '}' or '\n' for structure, 'w' for
+      a word, or zero at the end of the buffer. */
+  int Next(const char*& word);
 
-    // Slash-newline continuation
-    if (ch == '\\') {
-      ch = fgetc(f);
-      if (ch == '\n') {
-        ++line;
-        continue;
-      }
-    }
+  /** Current line number */
+  int line() const { return line_; }
 
-  } while (ch == '\r');
+private:
+  void SkipSpace();
+  void SkipComment();
+  char Getch();
+  const char* Word(bool escaped);
+  int Quote(const char*& word);
+  const char* Terminate(char* start, char* write);
 
-  // Skip comment lines
-  if (ch == '#')
-    while (ch != EOF && (ch = fgetc(f)) != '\n');
+  char* p_;
+  char* end_;
+  Config& config_;
+  char pending_;
+  int line_;
+};
 
-  // Convert tabs to spaces
-  if (ch == '\t')
-    ch = ' ';
+int Config::Scanner::Next(const char*& word) {
+
+  // Structure character that was overwritten to terminate a word
+  if (pending_) {
+    int ch = pending_;
+    pending_ = 0;
+    if (ch == '\n')
+      ++line_;
+    return ch;
+  }
 
-  // Convert EOF to zero
-  if (ch == EOF)
+  SkipSpace();
+  if (p_ >= end_)
     return 0;
 
-  // Count newlines
-  if (ch == '\n')
-    ++line;
+  // A backslash hides itself and the character after it is read as is
+  char ch = *p_;
+  bool escaped = ch == '\\';
+  if (escaped && ++p_ >= end_)
+    return 0;
+  ch = *p_;
+  if (ch == '{' || ch == '}' || ch == '\n') {
+    ++p_;
+    if (ch == '\n')
+      ++line_;
+    return ch;
+  }
+  if (ch == '"')
+    return Quote(word);
+  word = Word(escaped);
+  return 'w';
+}
 
-  return (char)ch;
+void Config::Scanner::SkipSpace() {
+  while (p_ < end_) {
+    char ch = *p_;
+    int length = 1;
+    if (ch == '\\' && p_ + 1 < end_) {
+      ch = p_[1];
+      length = 2;
+    }
+    if ((classes$[ch] & CLASS_SPACE) || ch == '\r')
+      p_ += length;
+    else if (ch == '#') {
+      p_ += length;
+      SkipComment();
+    } else
+      break;
+  }
 }
 
-int Config::Node::SkipSpace(FILE* f, int& line) {
-  int ch;
-  for (ch = Getch(f, line); ch == ' '; ch = Getch(f, line));
-  return ch;
+void Config::Scanner::SkipComment() {
+  while (p_ < end_ && *p_ != '\n')
+    ++p_;
 }
 
-void Config::Node::Token(FILE* f, std::string& out, int& line) {
-  out.clear();
-  char ch = SkipSpace(f, line);
-  if (!ch)
-    return;
+char Config::Scanner::Getch() {
+  while (p_ < end_) {
+    char ch = *p_++;
+    if (ch == '\\') {
+      if (p_ >= end_)
+        break;
+      ch = *p_++;
+    }
+    if (ch == '\r')
+      continue;
+    if (ch == '#') {
+      SkipComment();
+      if (p_ >= end_)
+        break;
+      ch = *p_++;
+    }
+    if (ch == '\t')
+      ch = ' ';
+    else if (ch == '\n')
+      ++line_;
+    return ch;
+  }
+  return 0;
+}
 
-  // Read quote
-  if (ch == '"')
-    for (ch = Getch(f, line); ch && ch != '"'; ch = Getch(f, line)) {
-      if (ch == '\\') {
-        ch = Getch(f, line);
-        if (ch == 'n')
-          ch = '\n';
+const char* Config::Scanner::Word(bool escaped) {
+  char* start = p_;
+  if (escaped)
+    ++p_;
+
+  // Most words have nothing to unescape
+  while (p_ < end_ && !(classes$[*p_] & (CLASS_STOP | CLASS_SLOW)))
+    ++p_;
+
+  // Compact the rest of the word around carriage returns and escapes
+  char* write = p_;
+  while (p_ < end_) {
+    char ch = *p_;
+    if (ch == '\\') {
+      if (p_ + 1 >= end_) {
+        p_ = end_;
+        break;
+      }
+      ch = p_[1];
+
+      // An escaped separator still ends the word, drop only the backslash
+      if (classes$[ch] & CLASS_STOP) {
+        ++p_;
+        break;
       }
-      out.push_back(ch);
+      p_ += 2;
+      if (ch != '\r')
+        *write++ = ch;
+      continue;
     }
+    if (classes$[ch] & CLASS_STOP)
+      break;
+    ++p_;
+    if (ch != '\r')
+      *write++ = ch;
+  }
+  return Terminate(start, write);
+}
 
-  // Read brace
-  else if (ch == '{' || ch == '}' || ch == '\n')
-    out.push_back(ch);
+int Config::Scanner::Quote(const char*& word) {
+  char* start = ++p_;
+  char* write = p_;
+  bool nul = false;
+  for (char ch = Getch(); ch && ch != '"'; ch = Getch()) {
 
-  // Read identifier
-  else
-    for (; ch; ch = Getch(f, line)) {
-      if (ch == ' ' || ch == '{' || ch == '}' || ch == '\n') {
-        ungetc(ch, f);
+    // Only a doubled backslash is left to escape the next character. At
+    // the end of the file it escapes the terminator, which is kept.
+    if (ch == '\\') {
+      ch = Getch();
+      if (!ch) {
+        nul = true;
         break;
       }
-      out.push_back(ch);
+      if (ch == 'n')
+        ch = '\n';
     }
+    *write++ = ch;
+  }
+
+  // Each character read moves the write position at most one ahead, so
+  // the terminator fits unless the quote runs into the end of the file
+  int length = write - start;
+  word = Terminate(start, write);
+
+  // Quoted tokens are compared as text like any other, so a quoted brace
+  // or line break is structure and an empty quote ends the block
+  if (nul || length > 1)
+    return 'w';
+  if (!length)
+    return '}';
+  if (*word == '{' || *word == '}' || *word == '\n')
+    return *word;
+  return 'w';
+}
+
+const char* Config::Scanner::Terminate(char* start, char* write) {
+
+  // Compacted words have room before the delimiter
+  if (write < p_) {
+    *write = 0;
+    return start;
+  }
+
+  // Structure characters are remembered before being overwritten
+  if (p_ < end_) {
+    char ch = *p_;
+    *p_++ = 0;
+    if (ch == '{' || ch == '}' || ch == '\n')
+      pending_ = ch;
+    else if (ch == '#')
+      SkipComment();
+    return start;
+  }
+
+  // A word that runs into the end of the file has nowhere to put the
+  // terminator and is copied
+  return config_.Copy(start, write - start);
+}
+
+void* Config::Allocate(size_t size) {
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if (size > free_size_) {
+    size_t block = blocks_.empty() ? mapping_size_ : arena_size_;
+    if (block < arena_block$)
+      block = arena_block$;
+    if (block < size)
+      block = size;
+    blocks_.push_back(new char[block]);
+    free_ = blocks_.back();
+    free_size_ = block;
+    arena_size_ += block;
+  }
+  void* p = free_;
+  free_ += size;
+  free_size_ -= size;
+  return p;
+}
+
+const char* Config::Copy(const char* s, size_t length) {
+  char* copy = (char*)Allocate(length + 1);
+  memcpy(copy, s, length);
+  copy[length] = 0;
+  return copy;
 }
 
-Config::Node* Config::Node::Parse(FILE* f, const char* filename) {
-  std::string t;
+void Config::Finish(Node* node, std::vector<const char*>& tokens,
+                    size_t first) {
+  node->size_ = tokens.size() - first;
+  if (!node->size_)
+    return;
+  node->tokens_ = (const char**)Allocate(node->size_ * sizeof(const char*));
+  memcpy(node->tokens_, &tokens[first], node->size_ * sizeof(const char*));
+  tokens.resize(first);
+
+  // Most nodes are a single token, which is its own string
+  if (node->size_ == 1) {
+    node->string_ = node->tokens_[0];
+    return;
+  }
+  size_t length = 0;
+  for (int i = 0; i < node->size_; ++i)
+    length += strlen(node->tokens_[i]) + 1;
+  char* string = (char*)Allocate(length);
+  node->string_ = string;
+  for (int i = 0; i < node->size_; ++i) {
+    if (i)
+      *string++ = ' ';
+    size_t token_length = strlen(node->tokens_[i]);
+    memcpy(string, node->tokens_[i], token_length);
+    string += token_length;
+  }
+  *string = 0;
+}
+
+Config::Node* Config::Parse(Scanner& scanner,
+                            std::vector<const char*>& tokens) {
+
+  // Tokens of the nodes being parsed are stacked in the shared vector, a
+  // child block pops its own before the parent continues
   Node* cur = NULL;
   Node* prev = NULL;
   Node* root = NULL;
-  int line = 1;
-  for (Token(f, t, line); t.size(); Token(f, t, line)) {
-    if (t == "}")
-      break;
-    if (t == "\n") {
+  size_t first = tokens.size();
+  const char* word;
+  for (int type; (type = scanner.Next(word)) && type != '}';) {
+    if (type == '\n') {
       if (cur) {
+        Finish(cur, tokens, first);
         prev = cur;
         cur = NULL;
       }
       continue;
     }
     if (!cur) {
-      cur = new Node();
-      cur->filename_ = filename;
-      cur->line_ = line;
+      cur = new(Allocate(sizeof(Node))) Node();
+      cur->filename_ = filename_.c_str();
+      cur->line_ = scanner.line();
       if (prev)
         prev->next_ = cur;
       if (!root)
         root = cur;
+      ++nodes_;
     }
-    if (t == "{")
-      cur->child_ = Parse(f, filename);
-    else {
-      cur->tokens_.push_back(t);
-      if (cur->string_.size())
-        cur->string_ += " ";
-      cur->string_ += t;
-    }
+    if (type == '{')
+      cur->child_ = Parse(scanner, tokens);
+    else
+      tokens.push_back(word);
   }
+  if (cur)
+    Finish(cur, tokens, first);
   return root;
 }
 
-Config::Config(const char* filename): filename_(filename) {
-  FILE* f = fopen(filename, "r");
-  if (!f)
+Config::Config(const char* filename):
+  root_(NULL), filename_(filename), mapping_(NULL), mapping_size_(0),
+  free_(NULL), free_size_(0), arena_size_(0), nodes_(0) {
+  struct stat st;
+  if (stat(filename, &st)) {
     WARN("Failed to open configuration file '%s'", filename);
-  else {
-    DEBUG("Parsing configuration file '%s'", filename);
-    root_ = Node::Parse(f, filename_.c_str());
-    fclose(f);
+    return;
+  }
+  if (LoadCache(st))
+    return;
+  mapping_ = os::MapFile(filename, &mapping_size_);
+  if (!mapping_) {
+    if (st.st_size)
+      WARN("Failed to read configuration file '%s'", filename);
+    return;
   }
+  DEBUG("Parsing configuration file '%s'", filename);
+  char* begin = (char*)mapping_;
+  Scanner scanner(begin, begin + mapping_size_, *this);
+  std::vector<const char*> tokens;
+  root_ = Parse(scanner, tokens);
+  if (nodes_)
+    DEBUG("Parsed %d nodes, %d kB arena, %d bytes per node", nodes_,
+          (int)(arena_size_ + 1023) / 1024,
+          (int)((arena_size_ - free_size_) / nodes_));
+  SaveCache(st);
+}
+
+Config::~Config() {
+
+  // Nodes have no destructors, the whole tree goes with the arena
+  for (int i = 0; i < (int)blocks_.size(); ++i)
+    delete[] blocks_[i];
+  os::UnmapFile(mapping_, mapping_size_);
 }
 
 } // namespace dragoon
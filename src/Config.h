@@ -15,24 +15,26 @@
 
 namespace dragoon {
 
-/** Configuration file reader */
+/** Configuration file reader. The file is mapped into memory and tokens
+    point directly into the mapping. Nodes and token lists are allocated
+    from an arena owned by the Config object, so they are only valid while
+    it exists and are all freed together with it. */
 class Config {
 public:
+  class Scanner;
 
   /** Class representing a list of tokens and an optional block */
   class Node {
   public:
-    ~Node();
-
     /** Match a string token (case-insensitive) */
     bool Match(unsigned int i, const char* s) const {
-      if (i >= tokens_.size())
+      if (i >= (unsigned int)size_)
         return s == NULL;
-      return !strcasecmp(tokens_[i].c_str(), s);
+      return !strcasecmp(tokens_[i], s);
     }
 
-    /** Match the entire string */
-    bool Match(const char* s) const { return !strcasecmp(string_.c_str(), s); }
+    /** Match the entire string, tokens separated by single spaces */
+    bool Match(const char* s) const { return !strcasecmp(string_, s); }
 
     /** Get filename */
     const char* filename() const { return filename_; };
@@ -47,44 +49,60 @@ public:
     const Node* child() const { return child_; }
 
     /** Length of tokens list */
-    int size() const { return tokens_.size(); }
+    int size() const { return size_; }
 
     /** Return the entire string */
-    const char* c_str() const { return string_.c_str(); }
+    const char* c_str() const { return string_; }
 
     /** Return a token as a string */
     const char* token(unsigned int i) const {
-      return i < tokens_.size() ? tokens_[i].c_str() : "";
+      return i < (unsigned int)size_ ? tokens_[i] : "";
     }
 
-    /** Build a node graph by reading from a file stream */
-    static Node* Parse(FILE* stream, const char* filename = NULL);
-
   private:
-    Node(): next_(NULL), child_(NULL) {}
+    friend class Config;
 
-    // Some helper functions for parsing
-    static char Getch(FILE*, int& line);
-    static int SkipSpace(FILE*, int& line);
-    static void Token(FILE*, std::string&, int& line);
+    Node(): tokens_(NULL), string_(""), next_(NULL), child_(NULL), size_(0) {}
 
-    std::vector<std::string> tokens_;
-    std::string string_;
+    const char** tokens_;
+    const char* string_;
     Node* next_;
     Node* child_;
     const char* filename_;
     int line_;
+    int size_;
   };
 
   /** Read in and parse configuration file */
   Config(const char* filename);
 
+  ~Config();
+
   /** Get the root node */
   const Node* root() { return root_; }
 
 private:
-  ptr::Scope<Node> root_;
+  static const char* CacheDir();
+  bool CachePath(std::string& path) const;
+  bool LoadCache(const struct stat& source);
+  void SaveCache(const struct stat& source) const;
+
+  void* Allocate(size_t size);
+  const char* Copy(const char* s, size_t length);
+  Node* Parse(Scanner& scanner, std::vector<const char*>& tokens);
+  void Finish(Node* node, std::vector<const char*>& tokens, size_t first);
+
+  Node* root_;
   const std::string filename_;
+  void* mapping_;
+  size_t mapping_size_;
+
+  // Arena blocks, only the last one has free space
+  std::vector<char*> blocks_;
+  char* free_;
+  size_t free_size_;
+  size_t arena_size_;
+  int nodes_;
 };
 
 } // namespace dragoon
@@ -0,0 +1,257 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../os.h"
+#include "../str.h"
+#include "../var.h"
+#include "../Config.h"
+
+namespace dragoon {
+
+namespace {
+  var::Bool cache$("config.cache", true,
+                   "Keep compiled configuration files in the user directory");
+
+  // Compiled configuration header. The source path follows it, then the
+  // node array, the token table and the string pool, each at a 4-byte
+  // aligned offset. Everything is indexed by offsets so the file can be
+  // used straight from the mapping. The source modification time is in
+  // nanoseconds.
+  struct Header {
+    char magic[8];
+    Sint64 mtime;
+    Sint64 size;
+    Uint32 path_length;
+    Uint32 nodes;
+    Uint32 nodes_offset;
+    Uint32 tokens;
+    Uint32 tokens_offset;
+    Uint32 strings_size;
+    Uint32 strings_offset;
+    Uint32 reserved;
+  };
+
+  // Nodes are stored with siblings next to each other. Child and next are
+  // node indices plus one so that zero can mean none. Strings are offsets
+  // into the string pool.
+  struct Record {
+    Uint32 child;
+    Uint32 next;
+    Uint32 first_token;
+    Uint32 size;
+    Uint32 string;
+    Uint32 line;
+  };
+
+  const char magic$[8] = { 'D', 'R', 'G', 'C', 'F', 'G', '0', '3' };
+
+  Uint32 Align(Uint32 offset) { return (offset + 3) & ~3; }
+
+  // Builds the string pool, storing each distinct string once
+  class Pool {
+  public:
+    Uint32 Intern(const char* s) {
+      std::map<std::string, Uint32>::iterator it = offsets_.find(s);
+      if (it != offsets_.end())
+        return it->second;
+      Uint32 offset = bytes_.size();
+      bytes_.insert(bytes_.end(), s, s + strlen(s) + 1);
+      offsets_[s] = offset;
+      return offset;
+    }
+
+    const std::vector<char>& bytes() const { return bytes_; }
+
+  private:
+    std::map<std::string, Uint32> offsets_;
+    std::vector<char> bytes_;
+  };
+}
+
+const char* Config::CacheDir() {
+  static std::string dir;
+  if (dir.empty()) {
+    const char* user_dir = os::UserDir();
+    if (!user_dir)
+      return NULL;
+    dir = std::string(user_dir) + "/configs";
+    if (!os::Mkdir(dir.c_str()))
+      return NULL;
+  }
+  return dir.c_str();
+}
+
+bool Config::CachePath(std::string& path) const {
+  const char* dir;
+  if (!cache$ || !(dir = CacheDir()))
+    return false;
+
+  // Compiled files are named by a hash of the source path, the full path is
+  // checked against the header when loading
+  char buf[16];
+  snprintf(buf, sizeof(buf), "/%08x.cfb", str::Hash(filename_.c_str()));
+  path = std::string(dir) + buf;
+  return true;
+}
+
+bool Config::LoadCache(const struct stat& source) {
+  std::string path;
+  if (!CachePath(path))
+    return false;
+  size_t size = 0;
+  void* data = os::MapFile(path.c_str(), &size);
+  if (!data)
+    return false;
+
+  // The compiled file is only good for the same version of the same file.
+  // The sections must follow each other in order, aligned and inside the
+  // file, before the path or anything they locate is read. Sizes are added
+  // up in 64 bits so they cannot wrap around.
+  const Header* header = (const Header*)data;
+  const char* base = (const char*)data;
+  Uint64 path_end = sizeof(Header) + (Uint64)filename_.size();
+  if (size < sizeof(Header) || memcmp(header->magic, magic$, sizeof(magic$))
+      || header->mtime != os::ModifiedTime(source)
+      || header->size != (Sint64)source.st_size
+      || header->path_length != filename_.size()
+      || header->nodes_offset < path_end || header->nodes_offset & 3
+      || header->tokens_offset < header->nodes_offset
+                                 + (Uint64)header->nodes * sizeof(Record)
+      || header->tokens_offset & 3
+      || header->strings_offset < header->tokens_offset
+                                  + (Uint64)header->tokens * 4
+      || (Uint64)size < header->strings_offset
+                        + (Uint64)header->strings_size
+      || memcmp(header + 1, filename_.c_str(), filename_.size())
+      || (header->strings_size
+          && base[header->strings_offset + header->strings_size - 1])) {
+    os::UnmapFile(data, size);
+    return false;
+  }
+
+  // Check every index before pointing nodes at the mapping, a damaged file
+  // must not send the game off into the weeds
+  const Record* records = (const Record*)(base + header->nodes_offset);
+  const Uint32* tokens = (const Uint32*)(base + header->tokens_offset);
+  const char* strings = base + header->strings_offset;
+  bool valid = true;
+  for (Uint32 i = 0; valid && i < header->nodes; ++i) {
+    const Record& r = records[i];
+    valid = r.child <= header->nodes && r.next <= header->nodes
+            && r.first_token + (Uint64)r.size <= header->tokens
+            && r.string < header->strings_size;
+  }
+  for (Uint32 i = 0; valid && i < header->tokens; ++i)
+    valid = tokens[i] < header->strings_size;
+  if (!valid) {
+    WARN("Compiled configuration '%s' is damaged", path.c_str());
+    os::UnmapFile(data, size);
+    return false;
+  }
+
+  // Fill in the nodes in one pass
+  mapping_ = data;
+  mapping_size_ = size;
+  nodes_ = header->nodes;
+  if (!nodes_)
+    return true;
+  Node* nodes = (Node*)Allocate(nodes_ * sizeof(Node));
+  const char** pointers = (const char**)Allocate(header->tokens
+                                                 * sizeof(const char*));
+  for (Uint32 i = 0; i < header->tokens; ++i)
+    pointers[i] = strings + tokens[i];
+  for (int i = 0; i < nodes_; ++i) {
+    const Record& r = records[i];
+    Node* node = new(nodes + i) Node();
+    node->tokens_ = pointers + r.first_token;
+    node->size_ = r.size;
+    node->string_ = strings + r.string;
+    node->next_ = r.next ? nodes + r.next - 1 : NULL;
+    node->child_ = r.child ? nodes + r.child - 1 : NULL;
+    node->filename_ = filename_.c_str();
+    node->line_ = r.line;
+  }
+  root_ = nodes;
+  DEBUG("Loaded compiled configuration '%s'", filename_.c_str());
+  return true;
+}
+
+void Config::SaveCache(const struct stat& source) const {
+  std::string path;
+  if (!CachePath(path))
+    return;
+
+  // Flatten the tree so each sibling list is contiguous, children are
+  // appended as their parents are reached
+  std::vector<const Node*> order;
+  std::vector<Record> records;
+  std::vector<Uint32> tokens;
+  Pool pool;
+  for (const Node* n = root_; n; n = n->next_)
+    order.push_back(n);
+  for (size_t i = 0; i < order.size(); ++i) {
+    const Node* n = order[i];
+    Record r;
+    r.child = n->child_ ? order.size() + 1 : 0;
+    r.next = n->next_ ? i + 2 : 0;
+    r.first_token = tokens.size();
+    r.size = n->size_;
+    r.string = pool.Intern(n->string_);
+    r.line = n->line_;
+    records.push_back(r);
+    for (int j = 0; j < n->size_; ++j)
+      tokens.push_back(pool.Intern(n->tokens_[j]));
+    for (const Node* c = n->child_; c; c = c->next_)
+      order.push_back(c);
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic$, sizeof(magic$));
+  header.mtime = os::ModifiedTime(source);
+  header.size = source.st_size;
+  header.path_length = filename_.size();
+  header.nodes = records.size();
+  header.nodes_offset = Align(sizeof(header) + filename_.size());
+  header.tokens = tokens.size();
+  header.tokens_offset = header.nodes_offset + records.size() * sizeof(Record);
+  header.strings_size = pool.bytes().size();
+  header.strings_offset = header.tokens_offset + tokens.size() * 4;
+
+  // Write to a temporary file and rename it so a partially written file is
+  // never picked up
+  std::string temp = path + ".tmp";
+  FILE* file = os::OpenWrite(temp.c_str());
+  if (!file)
+    return;
+  static const char padding[4] = { 0 };
+  int pad = header.nodes_offset - sizeof(header) - filename_.size();
+  bool success = fwrite(&header, sizeof(header), 1, file) == 1
+                 && fwrite(filename_.c_str(), filename_.size(), 1, file) == 1;
+  if (success && pad)
+    success = fwrite(padding, pad, 1, file) == 1;
+  if (success && !records.empty())
+    success = fwrite(&records[0], sizeof(Record), records.size(), file)
+              == records.size();
+  if (success && !tokens.empty())
+    success = fwrite(&tokens[0], 4, tokens.size(), file) == tokens.size();
+  if (success && !pool.bytes().empty())
+    success = fwrite(&pool.bytes()[0], pool.bytes().size(), 1, file) == 1;
+  fclose(file);
+  if (!success || rename(temp.c_str(), path.c_str())) {
+    WARN("Failed to write compiled configuration '%s'", path.c_str());
+    remove(temp.c_str());
+  }
+}
+
+} // namespace dragoon
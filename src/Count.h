@@ -15,12 +15,18 @@
 
 namespace dragoon {
 
-/** A counter for counting how often something happens per frame */
+/** A counter for counting how often something happens per frame. Each
+    thread adds to its own shard of the counter so that worker threads can
+    count without contending for a lock or a cache line. Reads add up the
+    shards. The rates are measured with the Timer, so they should be read
+    and reset on the main thread. */
 class Count {
 public:
   Count():
     start_frame_(Timer::frame()), start_msec_(Timer::time()),
-    last_msec_(0), value_(0) {}
+    last_msec_(0) {
+    memset(shards_, 0, sizeof(shards_));
+  }
 
   /** Average FPS while counter was running */
   float Fps() const {
@@ -35,7 +41,7 @@ public:
     int frames = Timer::frame() - start_frame_;
     if (frames < 1)
       return 0.f;
-    return value_ / frames;
+    return (float)value() / frames;
   }
 
   /** Per-second count of a counter */
@@ -43,7 +49,16 @@ public:
     float seconds = (Timer::time() - start_msec_) * 0.001f;
     if (seconds <= 0.f)
       return 0.f;
-    return value_ / seconds;
+    return value() / seconds;
+  }
+
+  /** Total count since the last reset */
+  Sint64 value() const {
+    Sint64 value = 0;
+    // A plain 64-bit load can tear on 32-bit builds, read atomically
+    for (int i = 0; i < SHARDS; ++i)
+      value += __sync_fetch_and_add(&shards_[i].value, (Sint64)0);
+    return value;
   }
 
   /** Polls a counter to see if \c interval msec have elapsed since the
@@ -61,34 +76,57 @@ public:
   void Reset() {
     start_msec_ = last_msec_ = Timer::time();
     start_frame_ = Timer::frame();
-    value_ = 0.f;
+    Set(0);
   }
 
   Count& operator=(int n) {
-    value_ = n;
+    Set(n);
     return *this;
   }
 
   Count& operator+=(int n) {
-    value_ += n;
+    __sync_fetch_and_add(&shards_[Shard()].value, (Sint64)n);
     return *this;
   }
 
   Count& operator++(int n) {
-    ++value_;
-    return *this;
+    return *this += 1;
   }
 
   Count& operator++() {
-    ++value_;
-    return *this;
+    return *this += 1;
   }
 
 private:
+  enum { SHARDS = 16 };
+
+  // Shards are padded and aligned to keep each one on its own cache line
+  struct Padded {
+    volatile Sint64 value;
+    char padding[64 - sizeof(Sint64)];
+  } __attribute__((aligned(64)));
+
+  // Threads are given shards in the order they first count. Past SHARDS
+  // threads share shards, which the atomic add keeps correct.
+  static int Shard() {
+    static __thread int shard = -1;
+    static volatile int next;
+    if (shard < 0)
+      shard = __sync_fetch_and_add(&next, 1) & (SHARDS - 1);
+    return shard;
+  }
+
+  // Set the total, a count added at the same time may land either side
+  void Set(Sint64 n) {
+    for (int i = 0; i < SHARDS; ++i)
+      __sync_lock_test_and_set(&shards_[i].value, i ? 0 : n);
+  }
+
+  // Mutable so that value() can read with an atomic add of zero
+  mutable Padded shards_[SHARDS];
   int start_frame_;
   int start_msec_;
   int last_msec_;
-  float value_;
 };
 
 } // namespace dragoon
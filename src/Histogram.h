@@ -0,0 +1,94 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#pragma once
+
+namespace dragoon {
+
+/** Histogram of unsigned values in fixed memory. Buckets are logarithmic
+    with eight to each power of two, so percentiles are within an eighth of
+    the true value. */
+class Histogram {
+public:
+  Histogram() { Reset(); }
+
+  /** Add a sample */
+  void Add(Uint32 value) {
+    ++buckets_[Bucket(value)];
+    ++count_;
+    sum_ += value;
+    if (value > max_)
+      max_ = value;
+  }
+
+  /** Returns the smallest bucket bound that at least \c fraction of the
+      samples fall under */
+  Uint32 Percentile(float fraction) const {
+    Uint64 target = (Uint64)(fraction * count_ + 0.5f);
+    if (target < 1)
+      target = 1;
+    Uint64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+      if ((seen += buckets_[i]) >= target)
+        return Upper(i) < max_ ? Upper(i) : max_;
+    return max_;
+  }
+
+  /** Number of samples */
+  Uint64 count() const { return count_; }
+
+  /** Average sample */
+  float mean() const { return count_ ? (float)sum_ / count_ : 0.f; }
+
+  /** Largest sample */
+  Uint32 max() const { return max_; }
+
+  /** Remove all samples */
+  void Reset() {
+    memset(buckets_, 0, sizeof(buckets_));
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+private:
+  enum {
+    SUB_BITS = 3,
+    SUB = 1 << SUB_BITS,
+    BUCKETS = (33 - SUB_BITS) * SUB,
+  };
+
+  // Values below SUB have a bucket each, larger values are bucketed by
+  // their highest bit and the SUB_BITS bits under it
+  static int Bucket(Uint32 value) {
+    if (value < SUB)
+      return value;
+    int shift = 31 - __builtin_clz(value) - SUB_BITS;
+    return (shift + 1) * SUB + ((value >> shift) & (SUB - 1));
+  }
+
+  // Largest value in a bucket
+  static Uint32 Upper(int bucket) {
+    if (bucket < SUB)
+      return bucket;
+    int shift = bucket / SUB - 1;
+    Uint64 upper = ((Uint64)(SUB + bucket % SUB + 1) << shift) - 1;
+    return upper > 0xffffffff ? 0xffffffff : (Uint32)upper;
+  }
+
+  Uint32 buckets_[BUCKETS];
+  Uint64 count_;
+  Uint64 sum_;
+  Uint32 max_;
+};
+
+} // namespace dragoon
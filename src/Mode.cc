@@ -11,6 +11,7 @@
 \******************************************************************************/
 
 #include "log.h"
+#include "prof.h"
 #include "var.h"
 #include "Timer.h"
 #include "Texture.h"
@@ -18,12 +19,21 @@
 
 namespace dragoon {
 
+namespace {
+
+  // Face count when the frame began, for the profiler's per-frame counter
+  Sint64 begin_faces$;
+}
+
 var::Bool Mode::fullscreen$("mode.fullscreen", false,
                             "Render fullscreen window");
 var::Int Mode::width$("mode.width", 1024, "Screen/window resolution width");
 var::Int Mode::height$("mode.height", 768, "Screen/window resolution height");
 var::Bool Mode::clear$("mode.clear", true);
 var::Int Mode::target_height$("mode.target_height", -1);
+var::Bool Mode::npot_allowed$("mode.npot", true,
+                              "Use non-power-of-two textures if supported");
+bool Mode::npot$;
 Count Mode::faces$;
 int Mode::init_frame$;
 int Mode::scale$;
@@ -77,6 +87,15 @@ void Mode::Set(int width, int height, bool fullscreen) {
         fullscreen ? "fullscreen" : "windowed", video->w, video->h,
         width_scaled$, height_scaled$, scale$);
 
+  // Non-power-of-two textures are core in OpenGL 2.0
+  const char* version = (const char*)glGetString(GL_VERSION);
+  const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+  bool supported = version && atoi(version) >= 2;
+  if (extensions && strstr(extensions, "GL_ARB_texture_non_power_of_two"))
+    supported = true;
+  npot$ = npot_allowed$ && supported;
+  DEBUG("Non-power-of-two textures %s", npot$ ? "enabled" : "disabled");
+
   // Update reset frame so we reinitialize textures as necessary
   init_frame$ = Timer::frame();
 
@@ -116,6 +135,8 @@ void Mode::Set(int width, int height, bool fullscreen) {
 }
 
 void Mode::Begin() {
+  PROFILE("Mode::Begin");
+  begin_faces$ = faces$.value();
   int clear_flags = GL_DEPTH_BUFFER_BIT;
   if (clear$)
     clear_flags |= GL_COLOR_BUFFER_BIT;
@@ -123,6 +144,8 @@ void Mode::Begin() {
 }
 
 void Mode::End() {
+  PROFILE("Mode::End");
+  prof::Counter("Faces", (double)(faces$.value() - begin_faces$));
   SDL_GL_SwapBuffers();
   Check();
 }
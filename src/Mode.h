@@ -45,6 +45,9 @@ public:
   static int init_frame() { return init_frame$; }
   static bool fullscreen() { return fullscreen$; }
 
+  /** Returns true if textures can have non-power-of-two sizes */
+  static bool npot() { return npot$; }
+
   /*
   void clip(Vec<2> origin, CVec size);
   void R_clip_disable(void);
@@ -65,6 +68,8 @@ private:
   static var::Int width$;
   static var::Bool clear$;
   static var::Bool fullscreen$;
+  static var::Bool npot_allowed$;
+  static bool npot$;
   static int height_scaled$;
   static int init_frame$;
   static int scale$;
@@ -12,11 +12,28 @@
 
 #include "log.h"
 #include "math.h"
+#include "os.h"
+#include "prof.h"
 #include "Mode.h"
 #include "Sprite.h"
 
 namespace dragoon {
 
+namespace {
+
+  // Collect the texture files named anywhere in a config tree
+  void FindFiles(const Config::Node* n, std::vector<std::string>& files) {
+    for (; n; n = n->next()) {
+      if (n->Match(0, "file") && n->size() > 1)
+        files.push_back(n->token(1));
+      FindFiles(n->child(), files);
+    }
+  }
+
+  // Missing sprites that have been warned about, by interned ID
+  std::vector<bool> warned$;
+}
+
 Sprite::sprites$T Sprite::sprites$;
 
 Vec<2> Sprite::Center() const {
@@ -34,6 +51,7 @@ Vec<2> Sprite::Center() const {
 void Sprite::Draw() {
   if (!data_ || z_ < 0.f || modulate_.a() <= 0.f)
     return;
+  PROFILE("Sprite::Draw");
 
   // TODO: Check if sprite is on-screen
   //if (!CVec_intersect(r_cameraOn ? r_camera : CVec(0, 0),
@@ -58,11 +76,19 @@ void Sprite::Draw() {
   glScalef(mirror_ ^ data_->mirror_ ? -size_.x() : size_.x(),
            flip_ ^ data_->flip_ ? -size_.y() : size_.y(), 0);
 
+  // Premultiplied textures use one blend func for alpha and additive
+  // sprites. Additive sprites just zero the alpha that darkens the
+  // background.
+  bool premultiplied = data_->texture_ && data_->texture_->premultiplied();
+
   // Additive blending
   if (data_->blend_ == Data::BLEND_ADD) {
     glEnable(GL_BLEND);
     glDisable(GL_ALPHA_TEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    if (premultiplied)
+      glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    else
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE);
   }
 
   // Solid color
@@ -75,7 +101,7 @@ void Sprite::Draw() {
   else {
     glEnable(GL_BLEND);
     glEnable(GL_ALPHA_TEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBlendFunc(premultiplied ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   }
 
   // Modulate color
@@ -83,11 +109,16 @@ void Sprite::Draw() {
   if (data_->flicker_ > 0)
     modulate[3] = modulate[3] * (1 - data_->flicker_) +
                   data_->flicker_ * math::UnitRand();
-  if (data_->blend_ == Data::BLEND_ADD) {
-    modulate *= modulate[3];
+  if (data_->blend_ == Data::BLEND_SOLID)
     modulate[3] = 1;
-  } else if (data_->blend_ == Data::BLEND_SOLID)
+  else if (premultiplied) {
+    float alpha = modulate[3];
+    modulate *= alpha;
+    modulate[3] = data_->blend_ == Data::BLEND_ADD ? 0 : alpha;
+  } else if (data_->blend_ == Data::BLEND_ADD) {
+    modulate *= modulate[3];
     modulate[3] = 1;
+  }
   modulate.Select();
 
   // Render the sprite quad(s)
@@ -103,28 +134,122 @@ void Sprite::Draw() {
 }
 
 const Sprite::Data* Sprite::Get(const char* name) {
-  std::string key(name);
-  if (sprites$.count(key))
-    return sprites$[key];
+
+  // Names are only looked up, so probing for a missing sprite leaves the
+  // string table and the tables indexed by it as they are
+  int id = str::Find(name);
+  if (id >= 0 && id < (int)sprites$.size() && sprites$[id])
+    return sprites$[id];
   WARN("Sprite '%s' not found", name);
   return NULL;
 }
 
+const Sprite::Data* Sprite::Get(SpriteId id) {
+  int i = id.id();
+  if (i < (int)sprites$.size() && sprites$[i])
+    return sprites$[i];
+  if (i >= (int)warned$.size())
+    warned$.resize(i + 1);
+  if (!warned$[i]) {
+    warned$[i] = true;
+    WARN("Sprite '%s' not found", str::Name(i));
+  }
+  return NULL;
+}
+
+Sprite::Data*& Sprite::Slot(const std::string& name) {
+  int id = str::Intern(name.c_str());
+  if (id >= (int)sprites$.size())
+    sprites$.resize(id + 1);
+  return sprites$[id];
+}
+
 void Sprite::LoadConfig(const char* filename) {
   Config config(filename);
+
+  // Decode all of the images up front so they load in parallel
+  std::vector<std::string> files;
+  FindFiles(config.root(), files);
+  Texture::Preload(files);
+
   for (const Config::Node* n = config.root(); n; n = n->next())
     ParseNode(n);
+
+  os::Watch(filename, ReloadConfig);
+  for (int i = 0; i < (int)files.size(); ++i)
+    os::Watch(files[i].c_str(), ReloadTexture);
+}
+
+void Sprite::ReloadConfig(const char* filename) {
+  Config config(filename);
+  std::vector<std::string> files;
+  FindFiles(config.root(), files);
+  Texture::Preload(files);
+  int count = 0;
+  for (const Config::Node* n = config.root(); n; n = n->next()) {
+    Data* data = Data::ParseNode(n);
+    if (!data->name_.size()) {
+      delete data;
+      continue;
+    }
+    Data*& slot = Slot(data->name_);
+    if (slot) {
+      slot->Replace(*data);
+      delete data;
+    } else
+      slot = data;
+    ++count;
+  }
+
+  // Texture options are whatever any sprite drawn from the texture asks
+  // for, so options removed from the config are worked out from scratch.
+  // The sprites then cut their tiled subtextures again with them.
+  std::vector<Texture*> textures;
+  for (int i = 0; i < (int)files.size(); ++i) {
+    Texture* texture = Texture::Load(files[i].c_str());
+    if (texture && std::find(textures.begin(), textures.end(), texture)
+                   == textures.end()) {
+      texture->ResetOptions();
+      textures.push_back(texture);
+    }
+  }
+  for (int i = 0; i < (int)sprites$.size(); ++i) {
+    Data* data = sprites$[i];
+    if (data && std::find(textures.begin(), textures.end(), data->texture_)
+                != textures.end())
+      data->ApplyTextureOptions();
+  }
+  for (int i = 0; i < (int)sprites$.size(); ++i) {
+    Data* data = sprites$[i];
+    if (data && std::find(textures.begin(), textures.end(), data->texture_)
+                != textures.end())
+      data->Prepare();
+  }
+
+  for (int i = 0; i < (int)files.size(); ++i)
+    os::Watch(files[i].c_str(), ReloadTexture);
+  DEBUG("Reloaded %d sprites from '%s'", count, filename);
+}
+
+void Sprite::ReloadTexture(const char* filename) {
+  Texture::Reload(filename);
+  for (int i = 0; i < (int)sprites$.size(); ++i) {
+    Data* data = sprites$[i];
+    if (data && data->texture_ && !strcmp(data->texture_->name(), filename))
+      data->Prepare();
+  }
 }
 
 const Sprite::Data* Sprite::ParseNode(const Config::Node* node) {
   Data* data = Data::ParseNode(node);
   if (data && data->name_.size()) {
-    if (sprites$.count(data->name_)) {
+    Data*& slot = Slot(data->name_);
+    if (slot) {
       WARN("Redeclared sprite '%s'", data->name_.c_str());
       delete data;
-      return sprites$[data->name_];
+      return slot;
     }
-    sprites$[data->name_] = data;
+    slot = data;
   }
   return data;
 }
@@ -12,11 +12,25 @@
 
 #pragma once
 #include "param.h"
+#include "str.h"
 #include "Config.h"
 #include "Texture.h"
 
 namespace dragoon {
 
+/** Handle to a sprite by name. The name is interned when the handle is
+    created, after which finding the sprite is an array index. */
+class SpriteId {
+public:
+  explicit SpriteId(const char* name): id_(str::Intern(name)) {}
+
+  /** Interned ID of the sprite name */
+  int id() const { return id_; }
+
+private:
+  int id_;
+};
+
 /** 2D sprite rendered onto the screen */
 class Sprite:
   public param::Angle, public param::Flip, public param::Mirror,
@@ -59,6 +73,18 @@ public:
     /** Initializes data structures from an anim config block */
     void ParseAnim(const Config::Node*);
 
+    /** Set the upscale filter, mipmap and low color options this sprite
+        asks for on its texture */
+    void ApplyTextureOptions() const;
+
+    /** Fill in defaults that depend on the texture and cut out the tiled
+        subtextures. Called again when the texture is reloaded. */
+    void Prepare();
+
+    /** Take on the contents of another sprite, which is left empty. Sprites
+        that point to this data see the change. */
+    void Replace(Data& other);
+
     /** Create and register a sprite from a configuration node */
     static Data* ParseNode(const Config::Node*);
 
@@ -82,9 +108,14 @@ public:
     float parallax_;
     float flicker_;
     int next_msec_;
+    int upscale_filter_;
     bool flip_;
     bool mirror_;
     bool up_scale_;
+    bool mipmap_;
+    bool low_color_;
+    bool have_box_;
+    bool have_center_;
   };
 
   /** 2D vertex */
@@ -110,23 +141,34 @@ public:
       size_ = data_->size();
   }
 
+  /** Initialize a sprite by handle */
+  Sprite(SpriteId id) {
+    if ((data_ = Get(id)))
+      size_ = data_->size();
+  }
+
   /** Get the sprite center point */
   Vec<2> Center() const;
 
   /** Draw the sprite on the screen */
   void Draw();
 
-  /** Get sprite data by name */
+  /** Get sprite data by name. Unknown names are not interned. */
   static const Data* Get(const char* name);
 
-  /** Load sprite config file */
+  /** Get sprite data by handle. Each missing sprite is only warned about
+      once. */
+  static const Data* Get(SpriteId id);
+
+  /** Load sprite config file. The file and its textures are watched and
+      reloaded when they change. */
   static void LoadConfig(const char* filename);
 
   /** Create and register a sprite from a configuration node */
   static const Data* ParseNode(const Config::Node*);
 
 private:
-  typedef ptr::Scope<Data>::Map<const std::string> sprites$T;
+  typedef ptr::Scope<Data>::Vector sprites$T;
 
   /** Renders a single quad sprite */
   void DrawQuad(bool smooth);
@@ -136,6 +178,16 @@ private:
       stretch to fill the rest of the sprite size. */
   void DrawWindow(bool smooth);
 
+  /** Returns the entry for a sprite name, indexed by its interned ID */
+  static Data*& Slot(const std::string& name);
+
+  /** Parse a changed sprite config file again, patching existing sprites
+      in place and adding new ones */
+  static void ReloadConfig(const char* filename);
+
+  /** Reload a changed texture and the sprites drawn from it */
+  static void ReloadTexture(const char* filename);
+
   static sprites$T sprites$;
 
   const Data *data_;
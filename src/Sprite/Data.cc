@@ -23,14 +23,17 @@ Sprite::Data::Data():
   blend_(BLEND_ALPHA),
   parallax_(0),
   flicker_(0),
+  upscale_filter_(-1),
   flip_(false),
   mirror_(false),
-  up_scale_(false)
+  up_scale_(false),
+  mipmap_(false),
+  low_color_(false),
+  have_box_(false),
+  have_center_(false)
   {}
 
 void Sprite::Data::ParseFrame(const Config::Node* n) {
-  bool have_box = false;
-  bool have_center = false;
   for (n = n->child(); n; n = n->next()) {
     const Config::Node* c = n->child();
 
@@ -59,7 +62,7 @@ void Sprite::Data::ParseFrame(const Config::Node* n) {
       if (c) {
         box_origin_ = Vec<2>(atof(c->token(0)), atof(c->token(1)));
         box_size_ = Vec<2>(atof(c->token(2)), atof(c->token(3)));
-        have_box = true;
+        have_box_ = true;
       } else
         WARN("Expected child block for box in %s:%d", n->filename(), n->line());
     }
@@ -68,7 +71,7 @@ void Sprite::Data::ParseFrame(const Config::Node* n) {
     else if (n->Match("center")) {
       if (c) {
         center_ = Vec<2>(atof(c->token(0)), atof(c->token(1)));
-        have_center = true;
+        have_center_ = true;
       } else
         WARN("Expected child block for center in %s:%d",
              n->filename(), n->line());
@@ -79,9 +82,20 @@ void Sprite::Data::ParseFrame(const Config::Node* n) {
       scale_ = c ? Vec<2>(atof(c->token(0)), atof(c->token(1)))
                  : Vec<2>(atof(n->token(1)), atof(n->token(1)));
 
-    // Force upscale
-    else if (n->Match("upscale"))
+    // Trilinear filtering when drawn small
+    else if (n->Match("mipmap"))
+      mipmap_ = true;
+
+    // Allow a 16-bit texture format
+    else if (n->Match("lowcolor"))
+      low_color_ = true;
+
+    // Force upscale, optionally with a filter
+    else if (n->Match(0, "upscale")) {
       up_scale_ = true;
+      if (n->size() > 1)
+        upscale_filter_ = Surface::ParseUpscale(n->token(1));
+    }
 
     // Window sprite
     else if (n->Match("window")) {
@@ -132,14 +146,36 @@ void Sprite::Data::ParseFrame(const Config::Node* n) {
            n->c_str(), n->filename(), n->line());
   }
 
+  ApplyTextureOptions();
+  Prepare();
+}
+
+void Sprite::Data::ApplyTextureOptions() const {
+
+  // Upscale filter, mipmaps and format apply to the whole texture
+  if (!texture_)
+    return;
+  if (upscale_filter_ >= 0)
+    texture_->set_upscale((Surface::Upscale)upscale_filter_);
+  if (mipmap_)
+    texture_->set_mipmap(true);
+  if (low_color_)
+    texture_->set_low_color(true);
+}
+
+void Sprite::Data::Prepare() {
+
   // Defaults
-  if (!have_box && texture_)
+  if (!have_box_ && texture_)
     box_size_ = texture_->size();
-  if (!have_center)
+  if (!have_center_)
     center_ = box_size_ / 2.f;
 
   // Create tiled window subtextures
   if (tile_) {
+    tiled_.Release();
+    for (int i = 0; i < 4; ++i)
+      edges_[i].Release();
 
     // Window tiling
     if (corner_[0] || corner_[1]) {
@@ -165,6 +201,19 @@ void Sprite::Data::ParseFrame(const Config::Node* n) {
   }
 }
 
+void Sprite::Data::Replace(Data& other) {
+  tiled_.Release();
+  for (int i = 0; i < 4; ++i)
+    edges_[i].Release();
+
+  // Member-wise copy takes the subtexture pointers along with everything
+  // else, so the other data must let go of them
+  *this = other;
+  other.tiled_ = (Texture*)NULL;
+  for (int i = 0; i < 4; ++i)
+    other.edges_[i] = (Texture*)NULL;
+}
+
 void Sprite::Data::ParseAnim(const Config::Node* n) {
   for (n = n->child(); n; n = n->next())
     anim_.push_back(Frame(n->token(0), atoi(n->token(1))));
@@ -17,6 +17,18 @@
 
 namespace dragoon {
 
+namespace {
+
+  // Setup the texture pixel format, RGBA in 32 bits. With these masks the
+  // channels are laid out R, G, B, A in memory regardless of byte order.
+  const Uint32 mask$[4]
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    = { 0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff };
+#else
+    = { 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000 };
+#endif
+}
+
 Surface::Surface(const char* filename): lock_(0) {
   FILE* file = os::OpenRead(filename);
   if (!file)
@@ -118,6 +130,12 @@ Surface::Surface(const char* filename): lock_(0) {
   fclose(file);
 }
 
+Surface::Surface(int width, int height, void* pixels, int pitch): lock_(0) {
+  ASSERT(width > 0 && height > 0);
+  ptr_ = SDL_CreateRGBSurfaceFrom(pixels, width, height, 32, pitch,
+                                  mask$[0], mask$[1], mask$[2], mask$[3]);
+}
+
 Surface::Surface(int x, int y, int w, int h) {
   Alloc(w, h);
   Lock();
@@ -290,64 +308,18 @@ bool Surface::Save(const char *filename) {
   return success;
 }
 
-void Surface::Deseam() {
-  if (Lock()) {
-    for (int y = 0; y < ptr_->h; ++y)
-      for (int x = 0; x < ptr_->w; ++x) {
-        Color color = Get(x, y);
-        if (!color[3]) {
-          Color sum = Color::black();
-          if (x > 0) {
-            color = Get(x - 1, y);
-            sum += color * color[3];
-          }
-          if (y > 0) {
-            color = Get(x, y - 1);
-            sum += color * color[3];
-          }
-          if (x < ptr_->w - 1) {
-            color = Get(x + 1, y);
-            sum += color * color[3];
-          }
-          if (y < ptr_->h - 1) {
-            color = Get(x, y + 1);
-            sum += color * color[3];
-          }
-          if (sum[3] > 0) {
-            sum /= sum[3];
-            sum[3] = 0;
-            Put(x, y, sum);
-          }
-        }
-      }
-    Unlock();
-  }
-}
-
 void Surface::Flip() {
   if (Lock()) {
-    for (int y = 0; y < ptr_->h / 2; y++)
-      for (int x = 0; x < ptr_->w; x++) {
-        Color color_top = Get(x, y);
-        Color color_bottom = Get(x, ptr_->h - y - 1);
-        Put(x, y, color_bottom);
-        Put(x, ptr_->h - y - 1, color_top);
-      }
-    Unlock();
-  }
-}
 
-void Surface::Scale(Surface& dest, int scale_x, int scale_y, int dx, int dy) {
-  if (Lock()) {
-    if (dest.Lock()) {
-      for (int y = 0; y < ptr_->h; y++)
-        for (int x = 0; x < ptr_->w; x++) {
-          Color color = Get(x, y);
-          for (int ys = 0; ys < scale_y; ys++)
-            for (int xs = 0; xs < scale_x; xs++)
-              dest.Put(dx + scale_x * x + xs, dy + scale_y * y + ys, color);
-        }
-      dest.Unlock();
+    // Swapping whole rows works for any pixel format
+    int len = ptr_->w * ptr_->format->BytesPerPixel;
+    std::vector<Uint8> buf(len);
+    for (int y = 0; y < ptr_->h / 2; y++) {
+      Uint8* top = Row(y);
+      Uint8* bottom = Row(ptr_->h - y - 1);
+      memcpy(&buf[0], top, len);
+      memcpy(top, bottom, len);
+      memcpy(bottom, &buf[0], len);
     }
     Unlock();
   }
@@ -357,22 +329,23 @@ void Surface::Blit(Surface& dest, int sx, int sy, int sw, int sh,
                    int dx, int dy) {
   if (Lock()) {
     if (dest.Lock()) {
-      for (int y = 0; y < sh; y++)
-        for (int x = 0; x < sw; x++)
-          dest.Put(dx + x, dy + y, Get(sx + x, sy + y));
-      dest.Unlock();
-    }
-    Unlock();
-  }
-}
-
-void Surface::Blit(Surface& dest, int sx, int sy, int sw, int sh,
-                   int dx, int dy, int dw, int dh) {
-  if (Lock()) {
-    if (dest.Lock()) {
-      for (int y = 0; y < dh; y++)
-        for (int x = 0; x < dw; x++)
-          dest.Put(dx + x, dy + y, Get(sx + x * sw / dw, sy + y * sh / dh));
+      if (Is32() && dest.IsRGBA()) {
+        Validate(sx, sy, sw, sh);
+        dest.Validate(dx, dy, sw, sh);
+        bool same = IsRGBA();
+        for (int y = 0; y < sh; y++) {
+          Uint32* src = (Uint32*)Row(sy + y) + sx;
+          Uint32* d = (Uint32*)dest.Row(dy + y) + dx;
+          if (same)
+            memcpy(d, src, 4 * sw);
+          else
+            for (int x = 0; x < sw; x++)
+              d[x] = ToRGBA(src[x]);
+        }
+      } else
+        for (int y = 0; y < sh; y++)
+          for (int x = 0; x < sw; x++)
+            dest.Put(dx + x, dy + y, Get(sx + x, sy + y));
       dest.Unlock();
     }
     Unlock();
@@ -384,14 +357,50 @@ void Surface::BlitShadowed(Surface& dest, int sx, int sy, int sw, int sh,
   ASSERT(sh_x >= 0 && sh_y >= 0);
   if (Lock()) {
     if (dest.Lock()) {
-      for (int y = 0; y < sh; y++)
-        for (int x = 0; x < sw; x++) {
-          Color sc = Get(sx + x, sy + y);
-          Color sh = Color::none();
-          if (x > sh_x && y > sh_y)
-            sh = Get(sx + x - sh_x, sy + y - sh_y) * shadow;
-          dest.Put(dx + x, dy + y, sc.Blend(sh));
+      if (Is32() && dest.IsRGBA()) {
+        Validate(sx, sy, sw, sh);
+        dest.Validate(dx, dy, sw, sh);
+        unsigned int shade[4];
+        for (int i = 0; i < 4; ++i)
+          shade[i] = (unsigned int)(255 * shadow[i]);
+        bool same = IsRGBA();
+        for (int y = 0; y < sh; y++) {
+          Uint32* src = (Uint32*)Row(sy + y) + sx;
+          Uint32* src_sh = y > sh_y ? (Uint32*)Row(sy + y - sh_y) + sx : NULL;
+          Uint8* d = dest.Row(dy + y) + 4 * dx;
+          for (int x = 0; x < sw; x++, d += 4) {
+            Uint32 fg = same ? src[x] : ToRGBA(src[x]);
+            const Uint8* c = (const Uint8*)&fg;
+
+            // Shadow color is the offset source pixel modulated by the
+            // shadow color, then the source pixel is blended on top
+            unsigned int s[4] = { 0, 0, 0, 0 };
+            if (src_sh && x > sh_x) {
+              Uint32 bg = same ? src_sh[x - sh_x] : ToRGBA(src_sh[x - sh_x]);
+              const Uint8* b = (const Uint8*)&bg;
+              for (int i = 0; i < 4; ++i)
+                s[i] = b[i] * shade[i] / 255;
+            }
+            unsigned int w = (255 - c[3]) * s[3];
+            unsigned int a = 255 * c[3] + w;
+            if (!a) {
+              *(Uint32*)d = 0;
+              continue;
+            }
+            for (int i = 0; i < 3; ++i)
+              d[i] = (255 * c[i] * c[3] + w * s[i]) / a;
+            d[3] = a / 255;
+          }
         }
+      } else
+        for (int y = 0; y < sh; y++)
+          for (int x = 0; x < sw; x++) {
+            Color sc = Get(sx + x, sy + y);
+            Color sh = Color::none();
+            if (x > sh_x && y > sh_y)
+              sh = Get(sx + x - sh_x, sy + y - sh_y) * shadow;
+            dest.Put(dx + x, dy + y, sc.Blend(sh));
+          }
       dest.Unlock();
     }
     Unlock();
@@ -402,22 +411,38 @@ void Surface::Alloc(int width, int height) {
   if (ptr_)
     SDL_FreeSurface(ptr_);
 
-  // Setup the texture pixel format, RGBA in 32 bits
-  unsigned int mask[4]
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    = { 0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff };
-#else
-    = { 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000 };
-#endif
-
   // Allocate the surface
   ASSERT(width > 0 && height > 0);
   ptr_ = SDL_CreateRGBSurface(SDL_HWSURFACE | SDL_SRCALPHA, width, height, 32,
-                              mask[0], mask[1], mask[2], mask[3]);
+                              mask$[0], mask$[1], mask$[2], mask$[3]);
   SDL_SetAlpha(ptr_, SDL_RLEACCEL, SDL_ALPHA_OPAQUE);
   ASSERT(ptr_->format != NULL);
 }
 
+bool Surface::Is32() const {
+  if (!ptr_ || !ptr_->format || ptr_->format->BytesPerPixel != 4)
+    return false;
+  const SDL_PixelFormat* f = ptr_->format;
+  return !f->Rloss && !f->Gloss && !f->Bloss && (!f->Aloss || !f->Amask);
+}
+
+bool Surface::IsRGBA() const {
+  if (!Is32())
+    return false;
+  const SDL_PixelFormat* f = ptr_->format;
+  return f->Rmask == mask$[0] && f->Gmask == mask$[1] &&
+         f->Bmask == mask$[2] && f->Amask == mask$[3];
+}
+
+Uint32 Surface::ToRGBA(Uint32 pixel) const {
+  const SDL_PixelFormat* f = ptr_->format;
+  Uint8 c[4] = { (Uint8)(pixel >> f->Rshift), (Uint8)(pixel >> f->Gshift),
+                 (Uint8)(pixel >> f->Bshift),
+                 f->Amask ? (Uint8)(pixel >> f->Ashift) : (Uint8)0xff };
+  memcpy(&pixel, c, sizeof (pixel));
+  return pixel;
+}
+
 void Surface::Validate(int x, int y) const {
   ASSERT(ptr_ != NULL);
   ASSERT(ptr_->format != NULL);
@@ -428,4 +453,11 @@ void Surface::Validate(int x, int y) const {
   ASSERT(lock_ >= 0);
 }
 
+void Surface::Validate(int x, int y, int w, int h) const {
+  if (w < 1 || h < 1)
+    return;
+  Validate(x, y);
+  Validate(x + w - 1, y + h - 1);
+}
+
 } // namespace dragoon
@@ -19,6 +19,19 @@ namespace dragoon {
 class Surface: public ptr::Scope<SDL_Surface, SDL_FreeSurface> {
 public:
 
+  /** Upscaling filter */
+  enum Upscale {
+    UPSCALE_NEAREST, ///< Blocky pixel repetition
+    UPSCALE_SCALEX,  ///< Scale2x/Scale3x edge smoothing
+    UPSCALE_XBR,     ///< Blended diagonal edges (xBR level one)
+  };
+
+  /** Resizing blit filter */
+  enum Resample {
+    RESAMPLE_NEAREST,  ///< Nearest source pixel
+    RESAMPLE_BILINEAR, ///< Blend of the four nearest source pixels
+  };
+
   /** Initialize with surface pointer */
   Surface(SDL_Surface* surf = NULL):
     ptr::Scope<SDL_Surface, SDL_FreeSurface>(surf), lock_(0) {}
@@ -31,6 +44,10 @@ public:
   /** Allocate blank surface through SDL */
   Surface(int width, int height): lock_(0) { Alloc(width, height); }
 
+  /** Wrap RGBA pixel memory without copying it. The memory is not freed
+      with the surface and must outlive it. */
+  Surface(int width, int height, void* pixels, int pitch);
+
   /** Reads in an area of the screen */
   Surface(int x, int y, int width, int height);
 
@@ -57,26 +74,71 @@ public:
       of their neighbors to prevent seam glitches during rotation */
   void Deseam();
 
+  /** Multiply color channels by alpha. Premultiplied surfaces blend and
+      filter without color bleeding, so they do not need Deseam(). */
+  void Premultiply();
+
+  /** Time the deseam kernels against each other on a generated image and
+      check that they produce identical output */
+  static void BenchmarkDeseam(int width = 2048, int height = 2048,
+                              int runs = 4);
+
   /** Vertically flip surface pixels */
   void Flip();
 
   /** Scale blit a surface to a destination surface by an integer size */
   void Scale(Surface& dest, int scale_x, int scale_y, int dx, int dy);
 
+  /** Scale blit with an edge-aware filter. Filters that do not support the
+      scale factor fall back to Scale(). */
+  void ScaleFiltered(Surface& dest, int scale, Upscale filter,
+                     int dx, int dy);
+
   /** Fast surface blit */
   void Blit(Surface& dest, int sx, int sy, int sw, int sh, int dx, int dy);
 
   /** Resizing surface blit */
   void Blit(Surface& dest, int sx, int sy, int sw, int sh,
-            int dx, int dy, int dw, int dh);
+            int dx, int dy, int dw, int dh,
+            Resample filter = RESAMPLE_NEAREST);
 
   /** Blit and add a shadow */
   void BlitShadowed(Surface& dest, int sx, int sy, int sw, int sh,
                     int dx, int dy, int sh_x, int sh_y, Color shadow);
 
+  /** Exchange surfaces with another wrapper */
+  void Swap(Surface& other) {
+    SDL_Surface* surface = ptr_;
+    int lock = lock_;
+    ptr_ = other.ptr_;
+    lock_ = other.lock_;
+    other.ptr_ = surface;
+    other.lock_ = lock;
+  }
+
+  /** Box filter the surface down to half size for the next mipmap level.
+      The destination must be at least half the size, rounded down, but
+      not less than one pixel.
+   *  @param premultiplied  If false, colors are weighted by alpha
+   */
+  void Downsample(Surface& dest, bool premultiplied);
+
   /** Returns true if the surface is valid */
   bool Valid() { return ptr_ != NULL && ptr_->w && ptr_->h; }
 
+  /** Get a cleared surface from the scratch pool. Surfaces are reused by
+      size and must be handed back with Recycle(). Main thread only. */
+  static Surface* Scratch(int width, int height);
+
+  /** Return a scratch surface to the pool */
+  static void Recycle(Surface* surface);
+
+  /** Print scratch pool hit and miss counts */
+  static void PrintPoolStats();
+
+  /** Returns the upscaling filter with the given name */
+  static Upscale ParseUpscale(const char* name);
+
   /** Returns the size of the surface */
   Vec<2> size() const
     { return ptr_ ? Vec<2>(ptr_->w, ptr_->h) : Vec<2>(0, 0); };
@@ -84,6 +146,20 @@ public:
 private:
   void Alloc(int width, int height);
   void Validate(int x, int y) const;
+  void Validate(int x, int y, int w, int h) const;
+
+  /** Returns true for 32-bit formats with 8-bit channels. These can be
+      read directly by the pixel kernels without going through SDL. */
+  bool Is32() const;
+
+  /** Returns true if the surface has the RGBA format allocated by Alloc() */
+  bool IsRGBA() const;
+
+  /** Convert a pixel read from this 32-bit surface to the RGBA format */
+  Uint32 ToRGBA(Uint32 pixel) const;
+
+  /** Returns a pointer to the first pixel of a row */
+  Uint8* Row(int y) const { return (Uint8*)ptr_->pixels + y * ptr_->pitch; }
 
   int lock_;
 };
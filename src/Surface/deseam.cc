@@ -0,0 +1,355 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../math.h"
+#include "../thread.h"
+#include "../Surface.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace dragoon {
+
+namespace {
+
+  // Deseams one row of RGBA pixels. Missing neighbor rows are passed as a
+  // row of transparent pixels, which carry no weight.
+  typedef void (*RowFunc)(Uint8* row, const Uint8* up, const Uint8* down,
+                          int w);
+
+  // Rows in a chunk of parallel work
+  const int chunk_rows$ = 16;
+
+  // Average the neighbors of a transparent pixel weighted by their alpha.
+  // The float math is done in the same order as DeseamColors() so that the
+  // result is bit-exact with it: the sum starts from opaque black and each
+  // neighbor adds its unit-ranged channels times its alpha. Dividing by
+  // 255.f gives the same floats as the generic path's double divide.
+  inline void DeseamPixel(Uint8* p, const Uint8* l, const Uint8* u,
+                          const Uint8* r, const Uint8* d) {
+    if (p[3])
+      return;
+    const Uint8* n[4] = { l, u, r, d };
+    float sum[4] = { 0, 0, 0, 1 };
+    for (int i = 0; i < 4; ++i) {
+      float alpha = n[i][3] / 255.f;
+      for (int j = 0; j < 4; ++j)
+        sum[j] += n[i][j] / 255.f * alpha;
+    }
+    for (int j = 0; j < 3; ++j)
+      p[j] = (Uint8)(255 * (sum[j] / sum[3]));
+  }
+
+  // Deseam the first and last pixels in a row, which have one neighbor less
+  void DeseamEnds(Uint8* row, const Uint8* up, const Uint8* down, int w) {
+    static const Uint8 none[4] = { 0, 0, 0, 0 };
+    int last = 4 * (w - 1);
+    DeseamPixel(row, none, up, w > 1 ? row + 4 : none, down);
+    if (w > 1)
+      DeseamPixel(row + last, row + last - 4, up + last, none, down + last);
+  }
+
+  // Deseam pixels from x through the second-to-last pixel in a row
+  void DeseamSpan(Uint8* row, const Uint8* up, const Uint8* down,
+                  int x, int w) {
+    for (int i = 4 * x; i < 4 * (w - 1); i += 4)
+      DeseamPixel(row + i, row + i - 4, up + i, row + i + 4, down + i);
+  }
+
+  void DeseamRow(Uint8* row, const Uint8* up, const Uint8* down, int w) {
+    DeseamSpan(row, up, down, 1, w);
+    DeseamEnds(row, up, down, w);
+  }
+
+#if defined(__SSE2__)
+
+  // Add the alpha-weighted channels of four neighbors to channel-planar
+  // sums, one pixel per lane. Each lane does the float operations of
+  // DeseamPixel() in the same order, so the result is bit-exact with it.
+  inline void WeighSSE2(__m128 sum[4], const Uint8* p) {
+    const __m128 scale = _mm_set1_ps(255.f);
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128 alpha = _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 24)), scale);
+    for (int j = 0; j < 3; ++j) {
+      __m128i c = _mm_and_si128(_mm_srli_epi32(v, 8 * j), mask);
+      __m128 unit = _mm_div_ps(_mm_cvtepi32_ps(c), scale);
+      sum[j] = _mm_add_ps(sum[j], _mm_mul_ps(unit, alpha));
+    }
+    sum[3] = _mm_add_ps(sum[3], _mm_mul_ps(alpha, alpha));
+  }
+
+  // Four pixels at a time from x through the second-to-last pixel. Groups
+  // without a transparent pixel are skipped with one test, the others are
+  // computed whole and blended in where the pixel was transparent.
+  int DeseamSpanSSE2(Uint8* row, const Uint8* up, const Uint8* down,
+                     int x, int w) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    const __m128 scale = _mm_set1_ps(255.f);
+    for (; x + 4 < w; x += 4) {
+      Uint8* p = row + 4 * x;
+      __m128i pix = _mm_loadu_si128((const __m128i*)p);
+      __m128i clear = _mm_cmpeq_epi32(_mm_and_si128(pix, alpha), zero);
+      if (!_mm_movemask_epi8(clear))
+        continue;
+      __m128 sum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(),
+                        _mm_set1_ps(1) };
+      WeighSSE2(sum, p - 4);
+      WeighSSE2(sum, up + 4 * x);
+      WeighSSE2(sum, p + 4);
+      WeighSSE2(sum, down + 4 * x);
+      __m128i out = zero;
+      for (int j = 0; j < 3; ++j) {
+        __m128 c = _mm_mul_ps(scale, _mm_div_ps(sum[j], sum[3]));
+        out = _mm_or_si128(out, _mm_slli_epi32(_mm_cvttps_epi32(c), 8 * j));
+      }
+      out = _mm_or_si128(_mm_and_si128(clear, out),
+                         _mm_andnot_si128(clear, pix));
+      _mm_storeu_si128((__m128i*)p, out);
+    }
+    return x;
+  }
+
+  void DeseamRowSSE2(Uint8* row, const Uint8* up, const Uint8* down, int w) {
+    DeseamSpan(row, up, down, DeseamSpanSSE2(row, up, down, 1, w), w);
+    DeseamEnds(row, up, down, w);
+  }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2 1
+
+  // WeighSSE2() for eight neighbors
+  __attribute__((target("avx2")))
+  inline void WeighAVX2(__m256 sum[4], const Uint8* p) {
+    const __m256 scale = _mm256_set1_ps(255.f);
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256 alpha = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v, 24)),
+                                 scale);
+    for (int j = 0; j < 3; ++j) {
+      __m256i c = _mm256_and_si256(_mm256_srli_epi32(v, 8 * j), mask);
+      __m256 unit = _mm256_div_ps(_mm256_cvtepi32_ps(c), scale);
+      sum[j] = _mm256_add_ps(sum[j], _mm256_mul_ps(unit, alpha));
+    }
+    sum[3] = _mm256_add_ps(sum[3], _mm256_mul_ps(alpha, alpha));
+  }
+
+  // Eight pixels at a time, then the SSE2 and scalar spans for the rest
+  __attribute__((target("avx2")))
+  void DeseamRowAVX2(Uint8* row, const Uint8* up, const Uint8* down, int w) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    const __m256 scale = _mm256_set1_ps(255.f);
+    int x = 1;
+    for (; x + 8 < w; x += 8) {
+      Uint8* p = row + 4 * x;
+      __m256i pix = _mm256_loadu_si256((const __m256i*)p);
+      __m256i clear = _mm256_cmpeq_epi32(_mm256_and_si256(pix, alpha), zero);
+      if (!_mm256_movemask_epi8(clear))
+        continue;
+      __m256 sum[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(),
+                        _mm256_setzero_ps(), _mm256_set1_ps(1) };
+      WeighAVX2(sum, p - 4);
+      WeighAVX2(sum, up + 4 * x);
+      WeighAVX2(sum, p + 4);
+      WeighAVX2(sum, down + 4 * x);
+      __m256i out = zero;
+      for (int j = 0; j < 3; ++j) {
+        __m256 c = _mm256_mul_ps(scale, _mm256_div_ps(sum[j], sum[3]));
+        out = _mm256_or_si256(out,
+                              _mm256_slli_epi32(_mm256_cvttps_epi32(c), 8 * j));
+      }
+      out = _mm256_or_si256(_mm256_and_si256(clear, out),
+                            _mm256_andnot_si256(clear, pix));
+      _mm256_storeu_si256((__m256i*)p, out);
+    }
+    x = DeseamSpanSSE2(row, up, down, x, w);
+    DeseamSpan(row, up, down, x, w);
+    DeseamEnds(row, up, down, w);
+  }
+
+#endif // x86
+#endif // __SSE2__
+
+  // Pick the widest kernel the processor supports
+  RowFunc BestRowFunc() {
+#if HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+      return DeseamRowAVX2;
+#endif
+#if defined(__SSE2__)
+    return DeseamRowSSE2;
+#else
+    return DeseamRow;
+#endif
+  }
+
+  // Shared state for deseaming a surface in chunks of rows. The rows
+  // bordering each chunk are copied beforehand so that no chunk reads
+  // pixels another thread is writing.
+  struct Job {
+    SDL_Surface* surf;
+    RowFunc func;
+    std::vector<Uint8> edges;
+    std::vector<Uint8> none;
+
+    Uint8* Row(int y) { return (Uint8*)surf->pixels + y * surf->pitch; }
+    Uint8* Edge(int chunk, bool below)
+      { return &edges[(2 * chunk + below) * 4 * surf->w]; }
+  };
+
+  void DeseamChunks(int first, int last, void* data) {
+    Job* job = (Job*)data;
+    int h = job->surf->h;
+    for (int c = first; c < last; ++c) {
+      int y0 = c * chunk_rows$;
+      int y1 = y0 + chunk_rows$ < h ? y0 + chunk_rows$ : h;
+      for (int y = y0; y < y1; ++y) {
+        const Uint8* up = !y ? &job->none[0]
+                             : y == y0 ? job->Edge(c, false) : job->Row(y - 1);
+        const Uint8* down = y == h - 1 ? &job->none[0]
+                            : y == y1 - 1 ? job->Edge(c, true)
+                                          : job->Row(y + 1);
+        job->func(job->Row(y), up, down, job->surf->w);
+      }
+    }
+  }
+
+  void DeseamRGBA(SDL_Surface* surf, RowFunc func, bool parallel) {
+    Job job;
+    job.surf = surf;
+    job.func = func;
+    int len = 4 * surf->w;
+    int chunks = (surf->h + chunk_rows$ - 1) / chunk_rows$;
+    job.none.resize(len);
+    job.edges.resize(2 * chunks * len);
+    for (int c = 0; c < chunks; ++c) {
+      int y0 = c * chunk_rows$;
+      int y1 = y0 + chunk_rows$;
+      if (y0 > 0)
+        memcpy(job.Edge(c, false), job.Row(y0 - 1), len);
+      if (y1 < surf->h)
+        memcpy(job.Edge(c, true), job.Row(y1), len);
+    }
+    if (parallel)
+      thread::Parallel(0, chunks, 1, DeseamChunks, &job);
+    else
+      DeseamChunks(0, chunks, &job);
+  }
+  // Deseam any locked surface format through Get() and Put()
+  void DeseamColors(Surface& surface) {
+    int w = surface->w, h = surface->h;
+    for (int y = 0; y < h; ++y)
+      for (int x = 0; x < w; ++x) {
+        Color color = surface.Get(x, y);
+        if (!color[3]) {
+          Color sum = Color::black();
+          if (x > 0) {
+            color = surface.Get(x - 1, y);
+            sum += color * color[3];
+          }
+          if (y > 0) {
+            color = surface.Get(x, y - 1);
+            sum += color * color[3];
+          }
+          if (x < w - 1) {
+            color = surface.Get(x + 1, y);
+            sum += color * color[3];
+          }
+          if (y < h - 1) {
+            color = surface.Get(x, y + 1);
+            sum += color * color[3];
+          }
+          if (sum[3] > 0) {
+            sum /= sum[3];
+            sum[3] = 0;
+            surface.Put(x, y, sum);
+          }
+        }
+      }
+  }
+}
+
+void Surface::Deseam() {
+  if (Lock()) {
+    if (IsRGBA())
+      DeseamRGBA(ptr_, BestRowFunc(), true);
+    else
+      DeseamColors(*this);
+    Unlock();
+  }
+}
+
+void Surface::BenchmarkDeseam(int width, int height, int runs) {
+
+  // Sprite-sheet-like test image: opaque blobs on a transparent background
+  Surface source(width, height);
+  source.Lock();
+  int seed = 1;
+  for (int y = 0; y < height; ++y) {
+    Uint8* p = source.Row(y);
+    for (int x = 0; x < width; ++x, p += 4) {
+      for (int i = 0; i < 4; ++i)
+        p[i] = (seed = math::Rand(seed)) >> 8;
+      if ((x / 24 + y / 24) % 2 == 0)
+        p[3] = 0;
+    }
+  }
+
+  // The generic Get() and Put() path is the reference for every kernel
+  struct {
+    const char* name;
+    RowFunc func;
+    bool parallel;
+  } kernels[] = {
+    { "scalar", DeseamRow, false },
+    { "scalar threaded", DeseamRow, true },
+#if defined(__SSE2__)
+    { "SSE2", DeseamRowSSE2, false },
+    { "SSE2 threaded", DeseamRowSSE2, true },
+#endif
+#if HAVE_AVX2
+    { "AVX2", DeseamRowAVX2, false },
+    { "AVX2 threaded", DeseamRowAVX2, true },
+#endif
+  };
+  Surface reference(width, height), work(width, height);
+  reference.Lock();
+  work.Lock();
+  int size = height * source->pitch;
+  memcpy(reference->pixels, source->pixels, size);
+  Uint32 start = SDL_GetTicks();
+  DeseamColors(reference);
+  DEBUG("Deseam %dx%d generic: %d msec", width, height,
+        SDL_GetTicks() - start);
+  for (int k = 0; k < (int)(sizeof (kernels) / sizeof (*kernels)); ++k) {
+#if HAVE_AVX2
+    if (kernels[k].func == DeseamRowAVX2 && !__builtin_cpu_supports("avx2"))
+      continue;
+#endif
+    int msec = 0;
+    for (int i = 0; i < runs; ++i) {
+      memcpy(work->pixels, source->pixels, size);
+      Uint32 start = SDL_GetTicks();
+      DeseamRGBA(work, kernels[k].func, kernels[k].parallel);
+      msec += SDL_GetTicks() - start;
+    }
+    bool exact = !memcmp(reference->pixels, work->pixels, size);
+    DEBUG("Deseam %dx%d %s: %.2f msec%s", width, height, kernels[k].name,
+          (float)msec / runs, exact ? "" : " (MISMATCH)");
+  }
+  DEBUG("Deseam benchmark used %d threads", thread::count());
+}
+
+} // namespace dragoon
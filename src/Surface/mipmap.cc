@@ -0,0 +1,116 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../Surface.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace dragoon {
+
+namespace {
+
+  // Box filter one destination pixel from up to nine source pixels. Color
+  // is weighted by alpha + 1 so transparent pixels do not darken edges but
+  // a fully transparent block still averages its colors. Premultiplied
+  // colors are plainly averaged. Alpha is always the plain average.
+  //
+  // The scalar and SSE2 versions do the same float operations in the same
+  // order, so they produce identical results.
+#if !defined(__SSE2__)
+  Uint32 BoxPixel(const Uint8* p[], int n, bool premultiplied) {
+    float sum[4] = { 0, 0, 0, 0 }, weights = 0, alpha = 0;
+    for (int i = 0; i < n; ++i) {
+      float w = premultiplied ? 1.f : p[i][3] + 1.f;
+      for (int j = 0; j < 4; ++j)
+        sum[j] += p[i][j] * w;
+      weights += w;
+      alpha += p[i][3];
+    }
+    Uint32 out;
+    Uint8* o = (Uint8*)&out;
+    for (int j = 0; j < 3; ++j)
+      o[j] = lrintf(sum[j] / weights);
+    o[3] = lrintf(alpha / n);
+    return out;
+  }
+#else
+  Uint32 BoxPixel(const Uint8* p[], int n, bool premultiplied) {
+    __m128i zero = _mm_setzero_si128();
+    __m128 one = _mm_set1_ps(1.f);
+    __m128 sum = _mm_setzero_ps(), weights = _mm_setzero_ps();
+    __m128 plain = _mm_setzero_ps();
+    for (int i = 0; i < n; ++i) {
+      __m128i v = _mm_cvtsi32_si128(*(const Uint32*)p[i]);
+      v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+      __m128 c = _mm_cvtepi32_ps(v);
+      __m128 w = premultiplied ? one
+                 : _mm_add_ps(_mm_shuffle_ps(c, c, 0xff), one);
+      sum = _mm_add_ps(sum, _mm_mul_ps(c, w));
+      weights = _mm_add_ps(weights, w);
+      plain = _mm_add_ps(plain, c);
+    }
+
+    // Color lanes from the weighted average, alpha from the plain one
+    __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    __m128 color = _mm_div_ps(sum, weights);
+    __m128 average = _mm_div_ps(plain, _mm_set1_ps((float)n));
+    __m128 out = _mm_or_ps(_mm_and_ps(mask, color),
+                           _mm_andnot_ps(mask, average));
+    __m128i i = _mm_cvtps_epi32(out);
+    i = _mm_packs_epi32(i, i);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+  }
+#endif
+}
+
+void Surface::Downsample(Surface& dest, bool premultiplied) {
+  if (!Lock())
+    return;
+  if (dest.Lock()) {
+    int w = ptr_->w > 1 ? ptr_->w / 2 : 1;
+    int h = ptr_->h > 1 ? ptr_->h / 2 : 1;
+    ASSERT(IsRGBA() && dest.IsRGBA());
+    dest.Validate(0, 0, w, h);
+    for (int y = 0; y < h; ++y) {
+
+      // Each box covers two rows. One pixel high sources have only the one
+      // row and the last box of an odd height source takes the leftover
+      // row too.
+      const Uint8* rows[3];
+      int row_count = ptr_->h > 1 ? 2 : 1;
+      if (y == h - 1 && ptr_->h > 1 && ptr_->h & 1)
+        row_count = 3;
+      for (int i = 0; i < row_count; ++i)
+        rows[i] = Row(2 * y + i);
+      Uint32* d = (Uint32*)dest.Row(y);
+      for (int x = 0; x < w; ++x) {
+
+        // Columns are boxed the same way as rows
+        int col_count = ptr_->w > 1 ? 2 : 1;
+        if (x == w - 1 && ptr_->w > 1 && ptr_->w & 1)
+          col_count = 3;
+        const Uint8* p[9];
+        int n = 0;
+        for (int i = 0; i < row_count; ++i)
+          for (int j = 0; j < col_count; ++j)
+            p[n++] = rows[i] + 4 * (2 * x + j);
+        d[x] = BoxPixel(p, n, premultiplied);
+      }
+    }
+    dest.Unlock();
+  }
+  Unlock();
+}
+
+} // namespace dragoon
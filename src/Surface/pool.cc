@@ -0,0 +1,76 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../Surface.h"
+
+namespace dragoon {
+
+namespace {
+
+  // Recycled surfaces are kept by exact size. Scratch surfaces are nearly
+  // always power-of-two, so there are only a handful of sizes in use.
+  struct Pool: public std::map<int, std::vector<Surface*> > {
+    ~Pool() {
+      for (iterator it = begin(); it != end(); ++it)
+        for (int i = 0; i < (int)it->second.size(); ++i)
+          delete it->second[i];
+    }
+  } pool$;
+
+  // Memory held by the pool is capped, anything over is freed
+  const int pool_max_bytes$ = 32 << 20;
+  int pool_bytes$;
+
+  // Statistics
+  int hits$, misses$;
+
+  int Key(int width, int height) { return width << 16 | height; }
+}
+
+Surface* Surface::Scratch(int width, int height) {
+  std::vector<Surface*>& free = pool$[Key(width, height)];
+  if (free.empty()) {
+    ++misses$;
+    return new Surface(width, height);
+  }
+  ++hits$;
+  Surface* surface = free.back();
+  free.pop_back();
+  pool_bytes$ -= (*surface)->pitch * height;
+
+  // Callers expect a cleared surface just like a new one
+  if (surface->Lock()) {
+    memset((*surface)->pixels, 0, (*surface)->pitch * height);
+    surface->Unlock();
+  }
+  return surface;
+}
+
+void Surface::Recycle(Surface* surface) {
+  if (!surface)
+    return;
+  int bytes = surface->Valid() ? (*surface)->pitch * (*surface)->h : 0;
+  if (!bytes || !surface->IsRGBA() || pool_bytes$ + bytes > pool_max_bytes$) {
+    delete surface;
+    return;
+  }
+  pool$[Key((*surface)->w, (*surface)->h)].push_back(surface);
+  pool_bytes$ += bytes;
+}
+
+void Surface::PrintPoolStats() {
+  DEBUG("Scratch surfaces: %d hits, %d misses, %d kB pooled",
+        hits$, misses$, pool_bytes$ / 1024);
+}
+
+} // namespace dragoon
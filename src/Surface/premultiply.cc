@@ -0,0 +1,76 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../Surface.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace dragoon {
+
+namespace {
+
+  // Exact rounded c * a / 255
+  inline Uint8 MulDiv255(int c, int a) {
+    int x = c * a + 128;
+    return (x + (x >> 8)) >> 8;
+  }
+
+  // Multiply the color channels of a row of RGBA pixels by their alpha
+  void PremultiplyRow(Uint8* p, int w) {
+    int x = 0;
+#if defined(__SSE2__)
+
+    // Alpha is broadcast over each pixel with 255 in its own lane so the
+    // alpha channel passes through unchanged
+    __m128i zero = _mm_setzero_si128();
+    __m128i alpha_lane = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    __m128i color_lanes = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    __m128i round = _mm_set1_epi16(128);
+    for (; x + 4 <= w; x += 4, p += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)p);
+      __m128i half[2] = { _mm_unpacklo_epi8(v, zero),
+                          _mm_unpackhi_epi8(v, zero) };
+      for (int i = 0; i < 2; ++i) {
+        __m128i a = _mm_shufflehi_epi16(
+          _mm_shufflelo_epi16(half[i], _MM_SHUFFLE(3, 3, 3, 3)),
+          _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_or_si128(_mm_and_si128(a, color_lanes), alpha_lane);
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(half[i], a), round);
+        half[i] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+      }
+      _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(half[0], half[1]));
+    }
+#endif
+    for (; x < w; ++x, p += 4)
+      for (int i = 0; i < 3; ++i)
+        p[i] = MulDiv255(p[i], p[3]);
+  }
+}
+
+void Surface::Premultiply() {
+  if (!Lock())
+    return;
+  if (IsRGBA())
+    for (int y = 0; y < ptr_->h; ++y)
+      PremultiplyRow(Row(y), ptr_->w);
+  else
+    for (int y = 0; y < ptr_->h; ++y)
+      for (int x = 0; x < ptr_->w; ++x) {
+        Color c = Get(x, y);
+        Put(x, y, Color(c.r() * c.a(), c.g() * c.a(), c.b() * c.a(), c.a()));
+      }
+  Unlock();
+}
+
+} // namespace dragoon
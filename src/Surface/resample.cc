@@ -0,0 +1,206 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../Surface.h"
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace dragoon {
+
+namespace {
+
+  // Bilinear source positions are stepped in 16.16 fixed point. Rounding
+  // the step up keeps exact ratios from landing one source pixel short.
+  Uint32 Step(int src, int dest) {
+    return (((Uint32)src << 16) + dest - 1) / dest;
+  }
+
+  // Nearest source index for each destination pixel. The table is built
+  // once per blit, so each index is divided exactly to pick the same pixel
+  // as the generic Get() and Put() path.
+  void NearestTable(std::vector<int>& table, int src, int dest) {
+    table.resize(dest);
+    for (int i = 0; i < dest; ++i)
+      table[i] = (int)((Sint64)i * src / dest);
+  }
+
+  // Bilinear source index pairs and 8-bit weights of the second index.
+  // Sample points are pixel centers so the image is not shifted.
+  void BilinearTable(std::vector<int>& first, std::vector<int>& second,
+                     std::vector<Uint8>& weight, int src, int dest) {
+    first.resize(dest);
+    second.resize(dest);
+    weight.resize(dest);
+    int step = Step(src, dest);
+    int pos = step / 2 - 0x8000;
+    for (int i = 0; i < dest; ++i, pos += step) {
+      int p = pos > 0 ? pos : 0;
+      int index = p >> 16;
+      if (index >= src - 1) {
+        first[i] = second[i] = src - 1;
+        weight[i] = 0;
+        continue;
+      }
+      first[i] = index;
+      second[i] = index + 1;
+      weight[i] = (p >> 8) & 0xff;
+    }
+  }
+
+  // Blend two rows channel by channel with the weight of the second row
+  void LerpRows(Uint32* dest, const Uint32* a, const Uint32* b, int w,
+                int weight) {
+    const Uint8* pa = (const Uint8*)a;
+    const Uint8* pb = (const Uint8*)b;
+    Uint8* d = (Uint8*)dest;
+    int n = 4 * w, i = 0;
+#if defined(__SSE2__)
+
+    // Products of 8-bit channels and 256 - weight fit unsigned 16-bit lanes
+    __m128i zero = _mm_setzero_si128();
+    __m128i wa = _mm_set1_epi16(256 - weight);
+    __m128i wb = _mm_set1_epi16(weight);
+    for (; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i*)(pa + i));
+      __m128i vb = _mm_loadu_si128((const __m128i*)(pb + i));
+      __m128i lo = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+      __m128i hi = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+      _mm_storeu_si128((__m128i*)(d + i),
+                       _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+                                        _mm_srli_epi16(hi, 8)));
+    }
+#endif
+    for (; i < n; ++i)
+      d[i] = (pa[i] * (256 - weight) + pb[i] * weight) >> 8;
+  }
+
+  // Blend horizontal pixel pairs out of a row through the bilinear tables
+  void LerpColumns(Uint32* d, const Uint32* s, const int* first,
+                   const int* second, const Uint8* weight, int w) {
+    int x = 0;
+#if defined(__SSE2__)
+
+    // Two destination pixels per vector
+    __m128i zero = _mm_setzero_si128();
+    __m128i full = _mm_set1_epi16(256);
+    for (; x + 2 <= w; x += 2) {
+      __m128i va = _mm_unpacklo_epi32(_mm_cvtsi32_si128(s[first[x]]),
+                                      _mm_cvtsi32_si128(s[first[x + 1]]));
+      __m128i vb = _mm_unpacklo_epi32(_mm_cvtsi32_si128(s[second[x]]),
+                                      _mm_cvtsi32_si128(s[second[x + 1]]));
+      short w0 = weight[x], w1 = weight[x + 1];
+      __m128i wb = _mm_set_epi16(w1, w1, w1, w1, w0, w0, w0, w0);
+      __m128i wa = _mm_sub_epi16(full, wb);
+      __m128i v = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+      v = _mm_srli_epi16(v, 8);
+      _mm_storel_epi64((__m128i*)(d + x), _mm_packus_epi16(v, v));
+    }
+#endif
+    for (; x < w; ++x) {
+      const Uint8* a = (const Uint8*)(s + first[x]);
+      const Uint8* b = (const Uint8*)(s + second[x]);
+      Uint8* p = (Uint8*)(d + x);
+      int wb = weight[x];
+      for (int i = 0; i < 4; ++i)
+        p[i] = (a[i] * (256 - wb) + b[i] * wb) >> 8;
+    }
+  }
+}
+
+void Surface::Blit(Surface& dest, int sx, int sy, int sw, int sh,
+                   int dx, int dy, int dw, int dh, Resample filter) {
+  if (Lock()) {
+    if (dest.Lock()) {
+      if (Is32() && dest.IsRGBA()) {
+        Validate(sx, sy, sw, sh);
+        dest.Validate(dx, dy, dw, dh);
+        if (sw > 0 && sh > 0 && dw > 0 && dh > 0) {
+
+          // Foreign 32-bit formats are converted a row at a time
+          bool same = IsRGBA();
+          std::vector<Uint32> converted[2];
+          if (!same) {
+            converted[0].resize(sw);
+            converted[1].resize(sw);
+          }
+
+          // Nearest sampling gathers through a column table and copies the
+          // previous row whenever the source row repeats
+          if (filter == RESAMPLE_NEAREST) {
+            std::vector<int> cols, rows;
+            NearestTable(cols, sw, dw);
+            NearestTable(rows, sh, dh);
+            for (int y = 0; y < dh; y++) {
+              Uint32* d = (Uint32*)dest.Row(dy + y) + dx;
+              if (y && rows[y] == rows[y - 1]) {
+                memcpy(d, (Uint32*)dest.Row(dy + y - 1) + dx, 4 * dw);
+                continue;
+              }
+              const Uint32* src = (const Uint32*)Row(sy + rows[y]) + sx;
+              for (int x = 0; x < dw; x++)
+                d[x] = src[cols[x]];
+              if (!same)
+                for (int x = 0; x < dw; x++)
+                  d[x] = ToRGBA(d[x]);
+            }
+          }
+
+          // Bilinear filtering blends the two source rows first, then the
+          // column pairs out of the blended row
+          else {
+            std::vector<int> x0, x1, y0, y1;
+            std::vector<Uint8> wx, wy;
+            BilinearTable(x0, x1, wx, sw, dw);
+            BilinearTable(y0, y1, wy, sh, dh);
+            std::vector<Uint32> blended(sw);
+            for (int y = 0; y < dh; y++) {
+              const Uint32* rows[2] = {
+                (const Uint32*)Row(sy + y0[y]) + sx,
+                (const Uint32*)Row(sy + y1[y]) + sx,
+              };
+              int count = wy[y] ? 2 : 1;
+              if (!same)
+                for (int i = 0; i < count; ++i) {
+                  for (int x = 0; x < sw; x++)
+                    converted[i][x] = ToRGBA(rows[i][x]);
+                  rows[i] = &converted[i][0];
+                }
+              const Uint32* src = rows[0];
+              if (count > 1) {
+                LerpRows(&blended[0], rows[0], rows[1], sw, wy[y]);
+                src = &blended[0];
+              }
+              LerpColumns((Uint32*)dest.Row(dy + y) + dx, src,
+                          &x0[0], &x1[0], &wx[0], dw);
+            }
+          }
+        }
+      } else
+        for (int y = 0; y < dh; y++)
+          for (int x = 0; x < dw; x++)
+            dest.Put(dx + x, dy + y, Get(sx + x * sw / dw, sy + y * sh / dh));
+      dest.Unlock();
+    }
+    Unlock();
+  }
+}
+
+} // namespace dragoon
@@ -0,0 +1,143 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../Surface.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace dragoon {
+
+namespace {
+
+  // Repeat each pixel of a row horizontally
+  void Repeat(Uint32* d, const Uint32* s, int w, int scale) {
+    for (int x = 0; x < w; ++x)
+      for (int i = 0; i < scale; ++i)
+        *d++ = s[x];
+  }
+
+  // Repeat each pixel S times with a fixed trip count the compiler unrolls
+  template<int S> void ExpandRow(Uint32* d, const Uint32* s, int w) {
+    for (int x = 0; x < w; ++x)
+      for (int i = 0; i < S; ++i)
+        *d++ = s[x];
+  }
+
+  template<> void ExpandRow<1>(Uint32* d, const Uint32* s, int w) {
+    memcpy(d, s, 4 * w);
+  }
+
+#if defined(__SSE2__)
+
+  // Four source pixels make two, three or four output vectors
+  template<> void ExpandRow<2>(Uint32* d, const Uint32* s, int w) {
+    int x = 0;
+    for (; x + 4 <= w; x += 4, d += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(s + x));
+      _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi32(v, v));
+      _mm_storeu_si128((__m128i*)(d + 4), _mm_unpackhi_epi32(v, v));
+    }
+    Repeat(d, s + x, w - x, 2);
+  }
+
+  template<> void ExpandRow<3>(Uint32* d, const Uint32* s, int w) {
+    int x = 0;
+    for (; x + 4 <= w; x += 4, d += 12) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(s + x));
+      _mm_storeu_si128((__m128i*)d,
+                       _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+      _mm_storeu_si128((__m128i*)(d + 4),
+                       _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+      _mm_storeu_si128((__m128i*)(d + 8),
+                       _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+    }
+    Repeat(d, s + x, w - x, 3);
+  }
+
+  template<> void ExpandRow<4>(Uint32* d, const Uint32* s, int w) {
+    int x = 0;
+    for (; x + 4 <= w; x += 4, d += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(s + x));
+      _mm_storeu_si128((__m128i*)d, _mm_shuffle_epi32(v, 0x00));
+      _mm_storeu_si128((__m128i*)(d + 4), _mm_shuffle_epi32(v, 0x55));
+      _mm_storeu_si128((__m128i*)(d + 8), _mm_shuffle_epi32(v, 0xaa));
+      _mm_storeu_si128((__m128i*)(d + 12), _mm_shuffle_epi32(v, 0xff));
+    }
+    Repeat(d, s + x, w - x, 4);
+  }
+
+#endif // __SSE2__
+
+  // Any other horizontal factor
+  void ExpandRow(Uint32* d, const Uint32* s, int w, int scale) {
+    switch (scale) {
+    case 1:
+      ExpandRow<1>(d, s, w);
+      break;
+    case 2:
+      ExpandRow<2>(d, s, w);
+      break;
+    case 3:
+      ExpandRow<3>(d, s, w);
+      break;
+    case 4:
+      ExpandRow<4>(d, s, w);
+      break;
+    default:
+      Repeat(d, s, w, scale);
+    }
+  }
+}
+
+void Surface::Scale(Surface& dest, int scale_x, int scale_y, int dx, int dy) {
+  if (Lock()) {
+    if (dest.Lock()) {
+      if (Is32() && dest.IsRGBA()) {
+        ASSERT(scale_x > 0 && scale_y > 0);
+        dest.Validate(dx, dy, ptr_->w * scale_x, ptr_->h * scale_y);
+        int len = 4 * ptr_->w * scale_x;
+        std::vector<Uint32> converted;
+        if (!IsRGBA())
+          converted.resize(ptr_->w);
+        for (int y = 0; y < ptr_->h; y++) {
+
+          // Foreign 32-bit formats are converted a row at a time
+          const Uint32* src = (const Uint32*)Row(y);
+          if (converted.size()) {
+            for (int x = 0; x < ptr_->w; x++)
+              converted[x] = ToRGBA(src[x]);
+            src = &converted[0];
+          }
+
+          // Expand one source row then replicate it
+          Uint8* first = dest.Row(dy + scale_y * y) + 4 * dx;
+          ExpandRow((Uint32*)first, src, ptr_->w, scale_x);
+          for (int ys = 1; ys < scale_y; ys++)
+            memcpy(dest.Row(dy + scale_y * y + ys) + 4 * dx, first, len);
+        }
+      } else
+        for (int y = 0; y < ptr_->h; y++)
+          for (int x = 0; x < ptr_->w; x++) {
+            Color color = Get(x, y);
+            for (int ys = 0; ys < scale_y; ys++)
+              for (int xs = 0; xs < scale_x; xs++)
+                dest.Put(dx + scale_x * x + xs, dy + scale_y * y + ys, color);
+          }
+      dest.Unlock();
+    }
+    Unlock();
+  }
+}
+
+} // namespace dragoon
@@ -0,0 +1,194 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../thread.h"
+#include "../Surface.h"
+
+namespace dragoon {
+
+namespace {
+
+  // Source and destination of an upscale pass
+  struct Job {
+    SDL_Surface* src;
+    SDL_Surface* dest;
+    int dx, dy;
+
+    // Source pixel with coordinates clamped to the surface
+    Uint32 Get(int x, int y) const {
+      x = x < 0 ? 0 : x >= src->w ? src->w - 1 : x;
+      y = y < 0 ? 0 : y >= src->h ? src->h - 1 : y;
+      return ((const Uint32*)((const Uint8*)src->pixels + y * src->pitch))[x];
+    }
+
+    // Destination row for a source row and sub-row
+    Uint32* Row(int y) const {
+      return (Uint32*)((Uint8*)dest->pixels + (dy + y) * dest->pitch) + dx;
+    }
+  };
+
+  // Scale2x: corners take the color of two matching orthogonal neighbors
+  void Scale2xRows(int first, int last, void* data) {
+    const Job& job = *(const Job*)data;
+    for (int y = first; y < last; ++y) {
+      Uint32* d0 = job.Row(2 * y);
+      Uint32* d1 = job.Row(2 * y + 1);
+      for (int x = 0; x < job.src->w; ++x, d0 += 2, d1 += 2) {
+        Uint32 b = job.Get(x, y - 1), d = job.Get(x - 1, y),
+               e = job.Get(x, y), f = job.Get(x + 1, y),
+               h = job.Get(x, y + 1);
+        if (b != h && d != f) {
+          d0[0] = d == b ? d : e;
+          d0[1] = b == f ? f : e;
+          d1[0] = d == h ? d : e;
+          d1[1] = h == f ? f : e;
+        } else
+          d0[0] = d0[1] = d1[0] = d1[1] = e;
+      }
+    }
+  }
+
+  // Scale3x: the same rule extended to the edge centers of a 3x3 block
+  void Scale3xRows(int first, int last, void* data) {
+    const Job& job = *(const Job*)data;
+    for (int y = first; y < last; ++y) {
+      Uint32* d0 = job.Row(3 * y);
+      Uint32* d1 = job.Row(3 * y + 1);
+      Uint32* d2 = job.Row(3 * y + 2);
+      for (int x = 0; x < job.src->w; ++x, d0 += 3, d1 += 3, d2 += 3) {
+        Uint32 a = job.Get(x - 1, y - 1), b = job.Get(x, y - 1),
+               c = job.Get(x + 1, y - 1), d = job.Get(x - 1, y),
+               e = job.Get(x, y), f = job.Get(x + 1, y),
+               g = job.Get(x - 1, y + 1), h = job.Get(x, y + 1),
+               i = job.Get(x + 1, y + 1);
+        if (b != h && d != f) {
+          d0[0] = d == b ? d : e;
+          d0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+          d0[2] = b == f ? f : e;
+          d1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+          d1[1] = e;
+          d1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+          d2[0] = d == h ? d : e;
+          d2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+          d2[2] = h == f ? f : e;
+        } else
+          d0[0] = d0[1] = d0[2] = d1[0] = d1[1] = d1[2] =
+            d2[0] = d2[1] = d2[2] = e;
+      }
+    }
+  }
+
+  // Perceptual distance between two RGBA pixels, weighted in YUV space
+  // with alpha counting as much as brightness
+  inline int Distance(Uint32 p, Uint32 q) {
+    const Uint8* a = (const Uint8*)&p;
+    const Uint8* b = (const Uint8*)&q;
+    int r = a[0] - b[0], g = a[1] - b[1], bl = a[2] - b[2];
+    int y = abs(299 * r + 587 * g + 114 * bl);
+    int u = abs(-169 * r - 331 * g + 500 * bl);
+    int v = abs(500 * r - 419 * g - 81 * bl);
+    return 48 * y + 7 * u + 6 * v + 48000 * abs(a[3] - b[3]);
+  }
+
+  // Average two RGBA pixels per channel
+  inline Uint32 Mix(Uint32 a, Uint32 b) {
+    return (a & b) + (((a ^ b) & 0xfefefefe) >> 1);
+  }
+
+  // xBR level one rule for the corner of E toward (sx, sy). The edge is
+  // detected by comparing color gradients along both diagonals over a 4x4
+  // window, and the corner is blended toward the closer of the two
+  // neighbors the edge runs between.
+  inline Uint32 XbrCorner(const Job& job, int x, int y, int sx, int sy) {
+    Uint32 e = job.Get(x, y);
+    Uint32 f = job.Get(x + sx, y), h = job.Get(x, y + sy);
+    Uint32 i = job.Get(x + sx, y + sy);
+    Uint32 b = job.Get(x, y - sy), d = job.Get(x - sx, y);
+    Uint32 c = job.Get(x + sx, y - sy), g = job.Get(x - sx, y + sy);
+    Uint32 f4 = job.Get(x + 2 * sx, y), i4 = job.Get(x + 2 * sx, y + sy);
+    Uint32 h5 = job.Get(x, y + 2 * sy), i5 = job.Get(x + sx, y + 2 * sy);
+    int across = Distance(e, c) + Distance(e, g) + Distance(i, f4) +
+                 Distance(i, h5) + 4 * Distance(h, f);
+    int along = Distance(h, d) + Distance(h, i5) + Distance(f, i4) +
+                Distance(f, b) + 4 * Distance(e, i);
+    if (across >= along)
+      return e;
+    return Mix(e, Distance(e, f) <= Distance(e, h) ? f : h);
+  }
+
+  void Xbr2xRows(int first, int last, void* data) {
+    const Job& job = *(const Job*)data;
+    for (int y = first; y < last; ++y) {
+      Uint32* d0 = job.Row(2 * y);
+      Uint32* d1 = job.Row(2 * y + 1);
+      for (int x = 0; x < job.src->w; ++x, d0 += 2, d1 += 2) {
+        d0[0] = XbrCorner(job, x, y, -1, -1);
+        d0[1] = XbrCorner(job, x, y, 1, -1);
+        d1[0] = XbrCorner(job, x, y, -1, 1);
+        d1[1] = XbrCorner(job, x, y, 1, 1);
+      }
+    }
+  }
+
+  // Run one upscale pass with source rows split across the worker pool
+  void Pass(SDL_Surface* src, SDL_Surface* dest, int dx, int dy,
+            thread::RangeFunc func) {
+    Job job = { src, dest, dx, dy };
+    thread::Parallel(0, src->h, 16, func, &job);
+  }
+}
+
+Surface::Upscale Surface::ParseUpscale(const char* name) {
+  if (!strcasecmp(name, "scale2x") || !strcasecmp(name, "scale3x") ||
+      !strcasecmp(name, "scalex"))
+    return UPSCALE_SCALEX;
+  if (!strcasecmp(name, "xbr"))
+    return UPSCALE_XBR;
+  if (strcasecmp(name, "nearest"))
+    WARN("Unrecognized upscale filter '%s'", name);
+  return UPSCALE_NEAREST;
+}
+
+void Surface::ScaleFiltered(Surface& dest, int scale, Upscale filter,
+                            int dx, int dy) {
+
+  // The filters are defined for factors of two and three only, and xBR
+  // only for two. Four is done as two passes at double size.
+  bool two = scale == 2 || scale == 4;
+  if (filter == UPSCALE_NEAREST || (!two && scale != 3) || !IsRGBA() ||
+      !dest.IsRGBA()) {
+    Scale(dest, scale, scale, dx, dy);
+    return;
+  }
+  if (filter == UPSCALE_XBR && scale == 3)
+    filter = UPSCALE_SCALEX;
+  thread::RangeFunc func = filter == UPSCALE_XBR ? Xbr2xRows
+                           : two ? Scale2xRows : Scale3xRows;
+  if (Lock()) {
+    if (dest.Lock()) {
+      dest.Validate(dx, dy, ptr_->w * scale, ptr_->h * scale);
+      if (scale == 4) {
+        Surface half(2 * ptr_->w, 2 * ptr_->h);
+        half.Lock();
+        Pass(ptr_, half, 0, 0, func);
+        Pass(half, dest, dx, dy, func);
+        half.Unlock();
+      } else
+        Pass(ptr_, dest, dx, dy, func);
+      dest.Unlock();
+    }
+    Unlock();
+  }
+}
+
+} // namespace dragoon
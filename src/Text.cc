@@ -11,6 +11,7 @@
 \******************************************************************************/
 
 #include "math.h"
+#include "prof.h"
 #include "Sprite.h"
 #include "Text.h"
 
@@ -77,6 +78,7 @@ void Text::SetText(const char *string) {
 void Text::Draw() {
   if (!font_ || !(*font_)->Valid() || !sprites_)
     return;
+  PROFILE("Text::Draw");
 
   // Setup sprite data for all characters
   Sprite::Data sprite_data;
@@ -12,51 +12,162 @@
 
 #include "log.h"
 #include "math.h"
+#include "os.h"
+#include "prof.h"
+#include "str.h"
 #include "Timer.h"
 #include "Mode.h"
+#include "thread.h"
+#include "var.h"
 #include "Texture.h"
 
 namespace dragoon {
 
+namespace {
+  var::String upscale$("texture.upscale", "nearest",
+                       "Upscaling filter: nearest, scale2x or xbr");
+  var::Bool premultiply$("texture.premultiply", false,
+                         "Premultiply texture alpha instead of deseaming");
+  var::Bool smooth_tiles$("texture.smooth_tiles", true,
+                          "Filter tiled textures stretched to power-of-two");
+
+  // Files being decoded by the worker threads
+  struct PreloadJob {
+    std::vector<std::string> names;
+    std::vector<Texture*> textures;
+  };
+}
+
 Texture::textures$T Texture::textures$;
+Texture::Memory Texture::memory$;
+
+Texture* Texture::Find(const char* name) {
+  int id = str::Find(name);
+  return id >= 0 && id < (int)textures$.size() ? textures$[id] : NULL;
+}
+
+Texture*& Texture::Slot(const char* name) {
+  int id = str::Intern(name);
+  if (id >= (int)textures$.size())
+    textures$.resize(id + 1);
+  return textures$[id];
+}
 
 Texture* Texture::Load(const char* name) {
-  std::string key(name);
-  if (textures$.count(key))
-    return textures$[key];
-  Texture* pt = new Texture(key.c_str());
-  textures$[std::string(name)] = pt;
-  return pt;
+  Texture*& texture = Slot(name);
+  if (!texture)
+    texture = new Texture(name);
+  return texture;
+}
+
+void Texture::Preload(const std::vector<std::string>& names) {
+
+  // Skip textures that are loaded already and repeated names
+  PreloadJob job;
+  std::map<std::string, bool> seen;
+  for (int i = 0; i < (int)names.size(); ++i)
+    if (!Find(names[i].c_str()) && !seen[names[i]]) {
+      seen[names[i]] = true;
+      job.names.push_back(names[i]);
+    }
+  if (job.names.empty())
+    return;
+
+  // Decoding and deseaming touch nothing shared, so each file is a
+  // separate work item. The map is only filled in afterwards.
+  int count = job.names.size();
+  Uint32 start = SDL_GetTicks();
+
+  // Create the cache directory before the workers race to do it
+  CacheDir();
+  job.textures.resize(count);
+  thread::Parallel(0, count, 1, PreloadRange, &job);
+  for (int i = 0; i < count; ++i)
+    Slot(job.names[i].c_str()) = job.textures[i];
+  DEBUG("Preloaded %d textures in %d msec", count, SDL_GetTicks() - start);
+  PrintCacheStats();
+}
+
+void Texture::PreloadRange(int first, int last, void* data) {
+  PreloadJob* job = (PreloadJob*)data;
+  for (int i = first; i < last; ++i)
+    job->textures[i] = new Texture(job->names[i].c_str());
+}
+
+void Texture::Reload(const char* name) {
+  Texture* texture = Find(name);
+  if (!texture)
+    return;
+  texture->surface_.Release();
+  os::UnmapFile(texture->mapping_, texture->mapping_size_);
+  texture->mapping_ = NULL;
+  texture->mapping_size_ = 0;
+
+  // Filtered copies are of the old pixels
+  for (ptr::Scope<Surface>::Map<int>::iterator jt = texture->upscaled_.begin();
+       jt != texture->upscaled_.end(); ++jt)
+    delete jt->second;
+  texture->upscaled_.clear();
+
+  texture->Decode();
+  texture->frame_ = -1;
+  DEBUG("Reloaded texture '%s'", name);
 }
 
 void Texture::Reset() {
   int count = 0;
-  for (textures$T::iterator it = textures$.begin(), end = textures$.end();
-       it != end; ++it) {
-    it->second->up_scale_ = false;
+  for (int i = 0; i < (int)textures$.size(); ++i) {
+    Texture* texture = textures$[i];
+    if (!texture)
+      continue;
+    texture->up_scale_ = false;
     if (WINDOWS) {
-      glDeleteTextures(1, &it->second->gl_name_);
-      it->second->gl_name_ = 0;
+      glDeleteTextures(1, &texture->gl_name_);
+      texture->gl_name_ = 0;
     }
     ++count;
   }
   DEBUG("Reset %d textures", count);
+  PrintStats();
+  Surface::PrintPoolStats();
+}
+
+void Texture::PrintStats() {
+  DEBUG("Textures use %d kB, mipmaps %d kB", memory$.bytes / 1024,
+        memory$.mipmap_bytes / 1024);
+  DEBUG("Saved %d kB with smaller formats, %d kB without pow2 padding",
+        memory$.format_saved / 1024, memory$.npot_saved / 1024);
+}
+
+void Texture::Account(const Memory& memory) {
+  memory$.bytes += memory.bytes - memory_.bytes;
+  memory$.mipmap_bytes += memory.mipmap_bytes - memory_.mipmap_bytes;
+  memory$.format_saved += memory.format_saved - memory_.format_saved;
+  memory$.npot_saved += memory.npot_saved - memory_.npot_saved;
+  memory_ = memory;
 }
 
 Texture::~Texture() {
   if (gl_name_)
     glDeleteTextures(1, &gl_name_);
+  Memory none = { 0, 0, 0, 0 };
+  Account(none);
+  surface_.Release();
+  os::UnmapFile(mapping_, mapping_size_);
 }
 
 Texture::Texture(int width, int height):
-  surface_(width, height), gl_name_(0), frame_(0), up_scale_(false),
-  tile_(false) {}
+  surface_(width, height), mapping_(NULL), mapping_size_(0), gl_name_(0),
+  frame_(0), upscale_(-1), format_(FORMAT_RGBA8), premultiplied_(false),
+  mipmap_(false), mipmapped_(false), low_color_(false), up_scale_(false),
+  tile_(false) { memset(&memory_, 0, sizeof(memory_)); }
 
 void Texture::Upload() {
 
   // Texture has no surface data
   if (!surface_)
     return;
+  PROFILE("Texture::Upload");
 
   // Surface size can be upscaled or not
   int scale = 1;
@@ -69,33 +180,63 @@ void Texture::Upload() {
 
   // Tiled texture span the entire surface
   Surface* pow2_surface = NULL;
+  Memory memory = { 0, 0, 0, 0 };
   if (tile_) {
     scale_uv_ = Vec<2>(1, 1);
 
-    // Allocate power-of-two surface
-    pow2_width_ = math::NextPow2(real_width);
-    pow2_height_ = math::NextPow2(real_height);
+    // Non-power-of-two textures can be uploaded as they are
+    if (Mode::npot()) {
+      pow2_width_ = real_width;
+      pow2_height_ = real_height;
+      memory.npot_saved = 4 * (math::NextPow2(real_width) *
+                               math::NextPow2(real_height) -
+                               real_width * real_height);
+      if (scale > 1) {
+        pow2_surface = Surface::Scratch(pow2_width_, pow2_height_);
+        surface_.Scale(*pow2_surface, scale, scale, 0, 0);
+      }
+    }
 
-    // We can just upload this surface if its already power-of-two
-    // otherwise we need to blit onto a new surface
-    if (pow2_width_ != surface_->w || pow2_height_ != surface_->h) {
-      pow2_surface = new Surface(pow2_width_, pow2_height_);
-      surface_.Blit(*pow2_surface, 0, 0, surface_->w, surface_->h,
-                    0, 0, pow2_width_, pow2_height_);
+    // Allocate power-of-two surface
+    else {
+      pow2_width_ = math::NextPow2(real_width);
+      pow2_height_ = math::NextPow2(real_height);
+
+      // We can just upload this surface if its already power-of-two
+      // otherwise we need to blit onto a new surface
+      if (pow2_width_ != surface_->w || pow2_height_ != surface_->h) {
+        pow2_surface = Surface::Scratch(pow2_width_, pow2_height_);
+        surface_.Blit(*pow2_surface, 0, 0, surface_->w, surface_->h,
+                      0, 0, pow2_width_, pow2_height_,
+                      smooth_tiles$ ? Surface::RESAMPLE_BILINEAR
+                                    : Surface::RESAMPLE_NEAREST);
+      }
     }
   }
 
   // Otherwise we use texture coords to isolate a piece and add a
   // one pixel border around the texture
   else {
-    pow2_width_ = math::NextPow2(real_width + 1);
-    pow2_height_ = math::NextPow2(real_height + 1);
+    if (Mode::npot()) {
+      pow2_width_ = real_width + 2;
+      pow2_height_ = real_height + 2;
+      memory.npot_saved = 4 * (math::NextPow2(real_width + 1) *
+                               math::NextPow2(real_height + 1) -
+                               pow2_width_ * pow2_height_);
+    } else {
+      pow2_width_ = math::NextPow2(real_width + 1);
+      pow2_height_ = math::NextPow2(real_height + 1);
+    }
 
     // We can just upload this surface if its already power-of-two
     // otherwise we need to blit onto a new surface
     if (pow2_width_ != surface_->w || pow2_height_ != surface_->h) {
-      pow2_surface = new Surface(pow2_width_, pow2_height_);
-      surface_.Scale(*pow2_surface, scale, scale, 1, 1);
+      pow2_surface = Surface::Scratch(pow2_width_, pow2_height_);
+      Surface* upscaled = scale > 1 ? Upscaled(scale) : NULL;
+      if (upscaled)
+        upscaled->Blit(*pow2_surface, 0, 0, real_width, real_height, 1, 1);
+      else
+        surface_.Scale(*pow2_surface, scale, scale, 1, 1);
     }
 
     // Save UV scale
@@ -106,21 +247,56 @@ void Texture::Upload() {
   // Upload the texture to OpenGL and build mipmaps
   glBindTexture(GL_TEXTURE_2D, gl_name_);
   Surface& upload_surface = pow2_surface ? *pow2_surface : surface_;
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, upload_surface->w,
-               upload_surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-               upload_surface->pixels);
+  format_ = ChooseFormat(upload_surface);
+  memory.bytes = UploadLevel(0, upload_surface);
+  int full_bytes = 4 * upload_surface->w * upload_surface->h;
   frame_ = Timer::frame();
 
-  // Repeat wrapping (not supported for NPOT textures)
+  // Mipmap levels are box filtered on the CPU, each from the one before
+  Surface* level = &upload_surface;
+  for (int i = 1; mipmap_ && ((*level)->w > 1 || (*level)->h > 1); ++i) {
+    int w = (*level)->w > 1 ? (*level)->w / 2 : 1;
+    int h = (*level)->h > 1 ? (*level)->h / 2 : 1;
+    Surface* next = Surface::Scratch(w, h);
+    level->Downsample(*next, premultiplied_);
+    memory.mipmap_bytes += UploadLevel(i, *next);
+    full_bytes += 4 * w * h;
+    if (level != &upload_surface)
+      Surface::Recycle(level);
+    level = next;
+  }
+  if (level != &upload_surface)
+    Surface::Recycle(level);
+  mipmapped_ = mipmap_;
+
+  // Track texture memory
+  memory.format_saved = full_bytes - memory.bytes - memory.mipmap_bytes;
+  Account(memory);
+
+  // Repeat wrapping (NPOT textures need ARB_texture_non_power_of_two)
   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-  // Free memory
-  delete pow2_surface;
+  // Scratch surface is reused by the next upload of the same size
+  Surface::Recycle(pow2_surface);
 
   Mode::Check();
 }
 
+Surface* Texture::Upscaled(int scale) {
+  Surface::Upscale filter = upscale_ >= 0 ? (Surface::Upscale)upscale_
+                            : Surface::ParseUpscale(upscale$.c_str());
+  if (filter == Surface::UPSCALE_NEAREST)
+    return NULL;
+  int key = scale << 8 | filter;
+  if (upscaled_.count(key))
+    return upscaled_[key];
+  Surface* upscaled = new Surface(surface_->w * scale, surface_->h * scale);
+  surface_.ScaleFiltered(*upscaled, scale, filter, 0, 0);
+  upscaled_[key] = upscaled;
+  return upscaled;
+}
+
 Texture* Texture::Extract(int x, int y, int w, int h) {
   if (!surface_)
     return NULL;
@@ -128,8 +304,12 @@ Texture* Texture::Extract(int x, int y, int w, int h) {
   // Allocate a new surface and copy the portion of the old surface onto it
   Texture* dest = new Texture(w, h);
   dest->tile_ = true;
-  surface_.Blit(dest->surface_, x, y, w, h, 0, 0, w, h);
-  dest->surface_.Deseam();
+  dest->premultiplied_ = premultiplied_;
+  dest->mipmap_ = mipmap_;
+  dest->low_color_ = low_color_;
+  surface_.Blit(dest->surface_, x, y, w, h, 0, 0);
+  if (!premultiplied_)
+    dest->surface_.Deseam();
   return dest;
 }
 
@@ -152,6 +332,10 @@ void Texture::Select(bool smooth) {
     need_upload = true;
   }
 
+  // Mipmaps were requested after the last upload
+  if (mipmap_ && !mipmapped_)
+    need_upload = true;
+
   // Stale textures must be uploaded again
   if (frame_ < Mode::init_frame())
     need_upload = true;
@@ -165,7 +349,8 @@ void Texture::Select(bool smooth) {
   glBindTexture(GL_TEXTURE_2D, gl_name_);
 
   // Scale filters
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  mipmapped_ ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
                   smooth ? GL_LINEAR : GL_NEAREST);
 
@@ -182,7 +367,30 @@ void Texture::Select(bool smooth) {
 }
 
 Texture::Texture(const char* filename):
-  surface_(filename), name_(filename), gl_name_(0), frame_(0), up_scale_(false),
-  tile_(false) { surface_.Deseam(); }
+  name_(filename), mapping_(NULL), mapping_size_(0), gl_name_(0), frame_(0),
+  upscale_(-1), format_(FORMAT_RGBA8), premultiplied_(premultiply$),
+  mipmap_(false), mipmapped_(false), low_color_(false), up_scale_(false),
+  tile_(false) {
+  memset(&memory_, 0, sizeof(memory_));
+  Decode();
+}
+
+void Texture::Decode() {
+
+  // Stat the source before reading it, so a file edited while it is
+  // decoded is not cached under the newer modification time
+  struct stat st;
+  bool have_stat = !stat(name_.c_str(), &st);
+  if (have_stat && LoadCache(st))
+    return;
+  Surface loaded(name_.c_str());
+  surface_.Swap(loaded);
+  if (premultiplied_)
+    surface_.Premultiply();
+  else
+    surface_.Deseam();
+  if (have_stat)
+    SaveCache(st);
+}
 
 } // namespace dragoon
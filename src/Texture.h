@@ -34,6 +34,27 @@ public:
   /** Cut a tilable chunk out of an already loaded texture */
   Texture* Extract(int x, int y, int width, int height);
 
+  /** Set the filter used to upscale this texture, overriding the
+      texture.upscale variable */
+  void set_upscale(Surface::Upscale upscale) { upscale_ = upscale; }
+
+  /** Upload a box-filtered mipmap chain with the texture and sample it
+      with trilinear filtering when drawn smaller than its size */
+  void set_mipmap(bool mipmap) { mipmap_ = mipmap; }
+
+  /** Allow uploading as dithered RGB565 or RGBA4444 */
+  void set_low_color(bool low_color) { low_color_ = low_color; }
+
+  /** Clear the upscale filter, mipmap and low color options so that a
+      reloaded sprite config can set them again. The texture is uploaded
+      again the next time it is used. */
+  void ResetOptions() {
+    upscale_ = -1;
+    mipmap_ = false;
+    low_color_ = false;
+    frame_ = -1;
+  }
+
   /** Selects (binds) a texture for rendering in OpenGL. Also sets whatever
       options are necessary to get the texture to show up properly. */
   void Select(bool smooth = false);
@@ -47,6 +68,9 @@ public:
   /** Smallest power-of-two dimensions that contain the surface */
   Vec<2> pow2_size() const { return Vec<2>(pow2_width_, pow2_height_); }
 
+  /** Returns true if the surface colors are premultiplied by alpha */
+  bool premultiplied() const { return premultiplied_; }
+
   /** Get texture name */
   const char* name() const { return name_.c_str(); }
 
@@ -59,24 +83,111 @@ public:
   /** Load a texture from disk or return a reference if already loaded */
   static Texture* Load(const char* name);
 
+  /** Decode a list of image files on the worker threads ahead of time so
+      that Load() finds them ready. Files already loaded are skipped. */
+  static void Preload(const std::vector<std::string>& names);
+
+  /** Decode a loaded texture again after its file changed. The texture
+      keeps its identity and is uploaded again the next time it is used. */
+  static void Reload(const char* name);
+
   /** Reset textures */
   static void Reset();
 
+  /** Print texture memory statistics */
+  static void PrintStats();
+
 protected:
   Texture(const char* name);
 
 private:
-  typedef ptr::Scope<Texture>::Map<std::string> textures$T;
+  typedef ptr::Scope<Texture>::Vector textures$T;
+
+  /** Pixel formats textures can be uploaded in */
+  enum Format {
+    FORMAT_RGBA8,
+    FORMAT_ALPHA8,
+    FORMAT_LUMINANCE_ALPHA8,
+    FORMAT_RGB565,
+    FORMAT_RGBA4444,
+  };
+
+  /** Texture memory accounting */
+  struct Memory {
+    int bytes;        ///< Level zero in video memory
+    int mipmap_bytes; ///< Mipmap levels in video memory
+    int format_saved; ///< Saved by formats smaller than RGBA8
+    int npot_saved;   ///< Saved by not padding to power-of-two
+  };
+
+  /** Replace this texture's share of the memory totals */
+  void Account(const Memory& memory);
+
+  /** Pick the smallest upload format that can hold the surface */
+  Format ChooseFormat(Surface& surface);
+
+  /** Convert a surface to the chosen format and upload it as a mipmap
+      level. Returns the number of bytes uploaded. */
+  int UploadLevel(int level, Surface& surface);
+
+  /** Returns the loaded texture with this name or NULL */
+  static Texture* Find(const char* name);
+
+  /** Returns the entry for a texture name, indexed by its interned ID */
+  static Texture*& Slot(const char* name);
+
+  /** Decode the file into the surface, from the cache if possible */
+  void Decode();
+
+  /** Worker thread function that constructs a range of preloaded textures */
+  static void PreloadRange(int first, int last, void* data);
+
+  /** Returns the directory decoded textures are cached in, or NULL if
+      there is none */
+  static const char* CacheDir();
+
+  /** Print the number of textures loaded from the cache */
+  static void PrintCacheStats();
+
+  /** Get the cache file path for this texture. Returns false if caching is
+      disabled. */
+  bool CachePath(std::string& path) const;
+
+  /** Map the decoded pixels from the cache file. Returns false if there is
+      no cache file or it is out of date.
+   *  @param source   Status of the source file taken before decoding
+   */
+  bool LoadCache(const struct stat& source);
+
+  /** Write the decoded pixels to the cache file, stamped with the source
+      file status taken before it was decoded */
+  void SaveCache(const struct stat& source);
+
+  /** Returns the surface filtered up to the given scale, or NULL if the
+      texture should be scaled with plain pixel repetition. Filtered
+      surfaces are kept for each scale factor. */
+  Surface* Upscaled(int scale);
 
   static textures$T textures$;
+  static Memory memory$;
 
   Vec<2> scale_uv_;
   Surface surface_;
+  ptr::Scope<Surface>::Map<int> upscaled_;
   std::string name_;
+  void* mapping_;
+  size_t mapping_size_;
   unsigned int gl_name_;
   int pow2_width_;
   int pow2_height_;
   int frame_;
+  int upscale_;
+  Memory memory_;
+  Format format_;
+  bool premultiplied_;
+  bool mipmap_;
+  bool mipmapped_;
+  bool low_color_;
   bool up_scale_;
   bool tile_;
 };
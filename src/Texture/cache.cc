@@ -0,0 +1,159 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../os.h"
+#include "../str.h"
+#include "../var.h"
+#include "../Texture.h"
+
+namespace dragoon {
+
+namespace {
+  var::Bool cache$("texture.cache", true,
+                   "Keep decoded textures in the user directory");
+
+  // Cache file header. The source path follows it and the pixels start at
+  // a 16-byte aligned offset after that. Premultiplied and deseamed pixels
+  // are different, so the flag is part of the key. The source modification
+  // time is in nanoseconds.
+  struct Header {
+    char magic[8];
+    Uint32 width;
+    Uint32 height;
+    Sint64 mtime;
+    Sint64 size;
+    Uint32 path_length;
+    Uint32 pixels_offset;
+    Uint32 premultiplied;
+    Uint32 reserved;
+  };
+
+  const char magic$[8] = { 'D', 'R', 'G', 'T', 'E', 'X', '0', '3' };
+
+  // Cache statistics, updated from the preload threads
+  int hits$, misses$;
+}
+
+const char* Texture::CacheDir() {
+  static std::string dir;
+  if (dir.empty()) {
+    const char* user_dir = os::UserDir();
+    if (!user_dir)
+      return NULL;
+    dir = std::string(user_dir) + "/textures";
+    if (!os::Mkdir(dir.c_str()))
+      return NULL;
+  }
+  return dir.c_str();
+}
+
+bool Texture::CachePath(std::string& path) const {
+  const char* dir;
+  if (!cache$ || !(dir = CacheDir()))
+    return false;
+
+  // Cache files are named by a hash of the source path, the full path is
+  // checked against the header when loading
+  char buf[16];
+  snprintf(buf, sizeof(buf), "/%08x.tex", str::Hash(name_.c_str()));
+  path = std::string(dir) + buf;
+  return true;
+}
+
+bool Texture::LoadCache(const struct stat& source) {
+  std::string path;
+  if (!CachePath(path))
+    return false;
+  size_t size = 0;
+  void* data = os::MapFile(path.c_str(), &size);
+  if (!data) {
+    __sync_fetch_and_add(&misses$, 1);
+    return false;
+  }
+
+  // The cached pixels are only good for the same version of the same file.
+  // The header is checked before the path and the pixels it locates are
+  // read, so a truncated or damaged file is rejected.
+  const Header* header = (const Header*)data;
+  const char* cached_name = (const char*)(header + 1);
+  Uint64 path_end = sizeof(Header) + (Uint64)name_.size();
+  if (size < sizeof(Header) || memcmp(header->magic, magic$, sizeof(magic$))
+      || header->mtime != os::ModifiedTime(source)
+      || header->size != (Sint64)source.st_size
+      || header->path_length != name_.size()
+      || header->premultiplied != (Uint32)premultiplied_
+      || !header->width || !header->height
+      || header->pixels_offset < path_end || header->pixels_offset & 15
+      || (Uint64)size < header->pixels_offset
+                        + 4 * (Uint64)header->width * header->height
+      || memcmp(cached_name, name_.c_str(), name_.size())) {
+    os::UnmapFile(data, size);
+    __sync_fetch_and_add(&misses$, 1);
+    return false;
+  }
+
+  // Surface pixels point straight into the mapping
+  Surface mapped(header->width, header->height,
+                 (Uint8*)data + header->pixels_offset, 4 * header->width);
+  surface_.Swap(mapped);
+  mapping_ = data;
+  mapping_size_ = size;
+  __sync_fetch_and_add(&hits$, 1);
+  return true;
+}
+
+void Texture::SaveCache(const struct stat& source) {
+  std::string path;
+  if (!surface_.Valid() || !CachePath(path))
+    return;
+
+  // Write to a temporary file and rename it so a partially written cache
+  // file is never picked up
+  std::string temp = path + ".tmp";
+  FILE* file = os::OpenWrite(temp.c_str());
+  if (!file)
+    return;
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic$, sizeof(magic$));
+  header.width = surface_->w;
+  header.height = surface_->h;
+  header.mtime = os::ModifiedTime(source);
+  header.size = source.st_size;
+  header.path_length = name_.size();
+  header.premultiplied = premultiplied_;
+  header.pixels_offset = (sizeof(header) + name_.size() + 15) & ~15;
+  bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(name_.c_str(), name_.size(), 1, file) == 1;
+  static const char padding[16] = { 0 };
+  int pad = header.pixels_offset - sizeof(header) - name_.size();
+  if (success && pad)
+    success = fwrite(padding, pad, 1, file) == 1;
+  if (success && surface_.Lock()) {
+    for (int y = 0; success && y < surface_->h; ++y)
+      success = fwrite((Uint8*)surface_->pixels + y * surface_->pitch,
+                       4 * surface_->w, 1, file) == 1;
+    surface_.Unlock();
+  }
+  fclose(file);
+  if (!success || rename(temp.c_str(), path.c_str())) {
+    WARN("Failed to write texture cache '%s'", path.c_str());
+    remove(temp.c_str());
+  }
+}
+
+void Texture::PrintCacheStats() {
+  DEBUG("Texture cache: %d hits, %d misses", hits$, misses$);
+}
+
+} // namespace dragoon
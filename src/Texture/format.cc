@@ -0,0 +1,138 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../log.h"
+#include "../var.h"
+#include "../Texture.h"
+
+namespace dragoon {
+
+namespace {
+  var::Bool formats$("texture.formats", true,
+                     "Upload textures in smaller formats when possible");
+
+  // OpenGL parameters for each format
+  struct GLFormat {
+    GLint internal;
+    GLenum format;
+    GLenum type;
+    int bytes;
+  } gl_formats$[] = {
+    { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+    { GL_ALPHA8, GL_ALPHA, GL_UNSIGNED_BYTE, 1 },
+    { GL_LUMINANCE8_ALPHA8, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, 2 },
+    { GL_RGB5, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 2 },
+    { GL_RGBA4, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, 2 },
+  };
+
+  // 4x4 ordered dither thresholds
+  const int bayer$[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+  };
+
+  // Reduce an 8-bit channel to the given number of bits, adding an ordered
+  // dither threshold so that gradients do not band
+  inline int Dither(int value, int bits, int x, int y) {
+    int levels = (1 << bits) - 1;
+    int threshold = 2 * bayer$[y & 3][x & 3] + 1;
+    return (value * levels * 32 + threshold * 255) / (255 * 32);
+  }
+}
+
+Texture::Format Texture::ChooseFormat(Surface& surface) {
+  if (!formats$ || !surface.Lock())
+    return FORMAT_RGBA8;
+
+  // Visible pixels decide the format. Transparent pixel colors only matter
+  // for filtering at the edges, which gray or white texels handle as well.
+  bool white = !premultiplied_, gray = true, opaque = true;
+  for (int y = 0; y < surface->h && (gray || opaque); ++y) {
+    const Uint8* p = (const Uint8*)surface->pixels + y * surface->pitch;
+    for (int x = 0; x < surface->w; ++x, p += 4) {
+      if (p[3] < 255)
+        opaque = false;
+      if (!p[3])
+        continue;
+      if (p[0] != p[1] || p[0] != p[2])
+        gray = white = false;
+      else if (p[0] != 255)
+        white = false;
+    }
+  }
+  surface.Unlock();
+
+  // Glyph sheets and other single-color images only need alpha. Alpha
+  // textures take their color from the modulation color alone, so this
+  // does not work for premultiplied white.
+  if (white)
+    return FORMAT_ALPHA8;
+  if (gray)
+    return FORMAT_LUMINANCE_ALPHA8;
+  if (low_color_)
+    return opaque ? FORMAT_RGB565 : FORMAT_RGBA4444;
+  return FORMAT_RGBA8;
+}
+
+int Texture::UploadLevel(int level, Surface& surface) {
+  const GLFormat& f = gl_formats$[format_];
+  int w = surface->w, h = surface->h;
+  if (format_ == FORMAT_RGBA8) {
+    glTexImage2D(GL_TEXTURE_2D, level, f.internal, w, h, 0, f.format, f.type,
+                 surface->pixels);
+    return f.bytes * w * h;
+  }
+
+  // Convert into a packed buffer
+  std::vector<Uint8> buffer(f.bytes * w * h);
+  if (!surface.Lock())
+    return 0;
+  Uint8* d = &buffer[0];
+  for (int y = 0; y < h; ++y) {
+    const Uint8* p = (const Uint8*)surface->pixels + y * surface->pitch;
+    for (int x = 0; x < w; ++x, p += 4)
+      switch (format_) {
+      case FORMAT_ALPHA8:
+        *d++ = p[3];
+        break;
+      case FORMAT_LUMINANCE_ALPHA8:
+        *d++ = p[3] ? p[0] : (p[0] + p[1] + p[2]) / 3;
+        *d++ = p[3];
+        break;
+      case FORMAT_RGB565:
+        *(Uint16*)d = Dither(p[0], 5, x, y) << 11 |
+                      Dither(p[1], 6, x, y) << 5 | Dither(p[2], 5, x, y);
+        d += 2;
+        break;
+      case FORMAT_RGBA4444:
+        *(Uint16*)d = Dither(p[0], 4, x, y) << 12 |
+                      Dither(p[1], 4, x, y) << 8 |
+                      Dither(p[2], 4, x, y) << 4 | Dither(p[3], 4, x, y);
+        d += 2;
+        break;
+      default:
+        break;
+      }
+  }
+  surface.Unlock();
+
+  // Packed rows of one and two byte pixels are not four byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, level, f.internal, w, h, 0, f.format, f.type,
+               &buffer[0]);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return f.bytes * w * h;
+}
+
+} // namespace dragoon
@@ -11,15 +11,26 @@
 \******************************************************************************/
 
 #include "log.h"
+#include "os.h"
+#include "prof.h"
+#include "var.h"
 #include "Count.h"
 #include "Timer.h"
 
 namespace dragoon {
 
+namespace {
+  var::Float budget$("timer.budget", 1000 / 60.f,
+                     "Frame time budget in msec for the frame time report");
+}
+
 Count Timer::throttled_;
+Histogram Timer::frame_times_;
 int Timer::time_msec_;
 int Timer::frame_ = 1;
 int Timer::frame_msec_;
+int Timer::over_budget_;
+int Timer::over_twice_budget_;
 
 unsigned int Timer::Poll() {
   static unsigned int last_msec;
@@ -47,16 +58,50 @@ void Timer::ThrottleFps(int max_fps) {
   }
 }
 
+void Timer::PrintFrameTimes() {
+  if (!frame_times_.count())
+    return;
+  // Explicitly requested report, so not compiled out or rate limited
+  log::Printf(__FILE__, __LINE__, __func__, log::LEVEL_INFO,
+              "%d frames: mean %.2f, p50 %.2f, p95 %.2f, p99 %.2f, "
+              "max %.2f msec", (int)frame_times_.count(),
+              frame_times_.mean() * 0.001f,
+              frame_times_.Percentile(0.5f) * 0.001f,
+              frame_times_.Percentile(0.95f) * 0.001f,
+              frame_times_.Percentile(0.99f) * 0.001f,
+              frame_times_.max() * 0.001f);
+  log::Printf(__FILE__, __LINE__, __func__, log::LEVEL_INFO,
+              "%d frames over the %.1f msec budget, %d over twice the budget",
+              over_budget_, (float)budget$, over_twice_budget_);
+}
+
 void Timer::Update() {
   static unsigned int last_msec;
   time_msec_ = SDL_GetTicks();
   frame_msec_ = time_msec_ - last_msec;
   last_msec = time_msec_;
 
+  // Time frames to the microsecond for the histogram. The first frame
+  // includes startup and is left out.
+  static Uint64 last_nsec;
+  Uint64 nsec = os::Nanoseconds();
+  if (last_nsec) {
+    Uint32 usec = (Uint32)((nsec - last_nsec) / 1000);
+    frame_times_.Add(usec);
+    if (usec > budget$ * 1000)
+      ++over_budget_;
+    if (usec > budget$ * 2000)
+      ++over_twice_budget_;
+  }
+  last_nsec = nsec;
+
   // Report when a frame takes an unusually long time
   if (CHECKED && frame_msec_ >= 100)
     DEBUG("Frame %d lagged, %d msec", frame_, frame_msec_);
 
+  // Collect the profiled zone times for this frame
+  prof::EndFrame();
+
   ++frame_;
 }
 
@@ -11,6 +11,7 @@
 \******************************************************************************/
 
 #pragma once
+#include "Histogram.h"
 
 namespace dragoon {
 
@@ -33,6 +34,14 @@ public:
       the efficiency of sections of code. */
   static unsigned int Poll();
 
+  /** Histogram of frame times in microseconds since the program started */
+  static const Histogram& frame_times() { return frame_times_; }
+
+  /** Print frame time percentiles and the number of frames that went over
+      the timer.budget variable. Logged at info level, so it is also shown
+      in release builds. */
+  static void PrintFrameTimes();
+
   /** Return counter for time spent throttled this frame */
   static const Count& throttled() { return throttled_; }
 
@@ -58,7 +67,10 @@ private:
   static int frame_;
   static int frame_msec_;
   static int time_msec_;
+  static int over_budget_;
+  static int over_twice_budget_;
   static Count throttled_;
+  static Histogram frame_times_;
 };
 
 } // namespace dragoon
@@ -15,69 +15,484 @@
 namespace dragoon {
 namespace log {
 
+bool debug$;
+
 namespace {
   std::string program_name$;
   int detail$;
-  bool debug$;
   bool color$;
 
-  // Return a bash color code
-  const char* ColorCode(int a, int b) {
-    static char buf[128];
+  // Messages are queued in a ring buffer owned by the thread that logs them
+  // and written out by the writer thread. The owning thread only moves the
+  // head and the writer only moves the tail, so neither needs a lock.
+  const Uint32 ring_size$ = 1 << 18;
+
+  struct Ring {
+    Ring(): head(0), tail(0), dropped(0), next(NULL) {}
+
+    char data[ring_size$];
+    volatile Uint32 head;
+    volatile Uint32 tail;
+    int dropped;
+    Ring* next;
+  };
+
+  // Each queued message starts with this header. Deferred records point to
+  // their format string, file and function and are followed by the packed
+  // arguments. Text records have no format and are followed by the file,
+  // function and message strings.
+  struct Record {
+    Uint32 size;
+    int line;
+    int level;
+    const char* fmt;
+    const char* file;
+    const char* func;
+  };
+
+  // Longest message that is queued, longer messages are cut off
+  const int max_message$ = 1024;
+
+  // Rings are added to the front of the list and never removed
+  Ring* volatile rings$;
+  __thread Ring* ring$;
+
+  // Rate limits and the call sites that have had messages suppressed
+  int burst$ = 20;
+  Uint32 interval$ = 1000;
+  Site* volatile sites$;
+
+  // Writer thread
+  SDL_Thread* writer$;
+  SDL_mutex* drain_mutex$;
+  volatile bool running$;
+  volatile bool quit$;
+  const int writer_msec$ = 10;
+
+  // Append a bash color code
+  void AppendColor(std::string& out, int a, int b) {
     if (!color$)
-      return "";
-    if (a < 0 || b < 0)
-      return "\033[;m";
+      return;
+    if (a < 0 || b < 0) {
+      out += "\033[;m";
+      return;
+    }
+    char buf[16];
     snprintf(buf, sizeof(buf), "\033[%d;%dm", a, b);
-    return buf;
+    out += buf;
   }
 
-  // Print log message header. Returns 0 if message should not be printed.
-  int PrintStart(const char* file, int line, const char* func, Level level) {
-
-    // No debug prints unless debug mode is on
-    if (level < LEVEL_WARN && !debug$)
-      return 0;
-
-    // Print color-coded program, file, function, and line identifier
+  // Format a whole log message with its color-coded program, file,
+  // function and line identifier
+  void Format(std::string& out, const char* file, int line, const char* func,
+              Level level, const char* message) {
     bool first = true;
-    fprintf(stderr, "%s", ColorCode(1, 30));
+    AppendColor(out, 1, 30);
     if (!program_name$.empty()) {
-      fprintf(stderr, "%s", program_name$.c_str());
+      out += program_name$;
       first = false;
     }
-    if (file && (detail$ & DETAIL_FILE)) {
-      first = !first ? fprintf(stderr, ":"), 0: 0;
-      fprintf(stderr, "%s", file);
+    if (file && *file && (detail$ & DETAIL_FILE)) {
+      if (!first)
+        out += ":";
+      out += file;
+      first = false;
     }
     if (line > 0 && (detail$ & DETAIL_LINE)) {
-      first = !first ? fprintf(stderr, ":"), 0: 0;
-      fprintf(stderr, "%d", line);
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%s%d", first ? "" : ":", line);
+      out += buf;
+      first = false;
     }
-    if (func && (detail$ & DETAIL_FUNC)) {
-      first = !first ? fprintf(stderr, ":"), 0: 0;
-      fprintf(stderr, "%s", func);
+    if (func && *func && (detail$ & DETAIL_FUNC)) {
+      if (!first)
+        out += ":";
+      out += func;
+      first = false;
     }
     if (color$) {
       if (!first)
-        fprintf(stderr, detail$ && color$ ? " " : ": ");
+        out += detail$ ? " " : ": ";
       switch (level) {
       case LEVEL_ERROR:
-        fprintf(stderr, "%s", ColorCode(1, 31));
+        AppendColor(out, 1, 31);
         break;
       case LEVEL_WARN:
-        fprintf(stderr, "%s", ColorCode(1, 33));
+        AppendColor(out, 1, 33);
         break;
       default:
-        fprintf(stderr, "%s", ColorCode(-1, -1));
+        AppendColor(out, -1, -1);
         break;
       }
     } else if (!first)
-      fprintf(stderr, ": ");
+      out += ": ";
+    out += message;
+    out += "\n";
+    AppendColor(out, -1, -1);
+  }
+
+  // Copy into and out of a ring, wrapping around the end
+  void RingWrite(Ring* ring, Uint32 pos, const void* src, Uint32 size) {
+    Uint32 offset = pos & (ring_size$ - 1);
+    Uint32 first = size < ring_size$ - offset ? size : ring_size$ - offset;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, (const char*)src + first, size - first);
+  }
+
+  void RingRead(const Ring* ring, Uint32 pos, void* dest, Uint32 size) {
+    Uint32 offset = pos & (ring_size$ - 1);
+    Uint32 first = size < ring_size$ - offset ? size : ring_size$ - offset;
+    memcpy(dest, ring->data + offset, first);
+    memcpy((char*)dest + first, ring->data, size - first);
+  }
+
+  // Queue a record on the calling thread's ring. Returns false if it is
+  // full, in which case the record is counted as dropped.
+  bool Push(Record& record, const char* payload, Uint32 size) {
+    Ring* ring = ring$;
+    if (!ring) {
+      ring = ring$ = new Ring();
+      do {
+        ring->next = rings$;
+      } while (!__sync_bool_compare_and_swap(&rings$, ring->next, ring));
+    }
+    record.size = sizeof(Record) + size;
+    Uint32 head = ring->head;
+    if (record.size > ring_size$ / 4
+        || head - ring->tail + record.size > ring_size$) {
+      __sync_fetch_and_add(&ring->dropped, 1);
+      return false;
+    }
+    RingWrite(ring, head, &record, sizeof(record));
+    RingWrite(ring, head + sizeof(record), payload, size);
+
+    // Publish the record only after its contents are written
+    __sync_synchronize();
+    ring->head = head + record.size;
+    return true;
+  }
+
+  // Queue an already formatted message
+  bool PushText(const char* file, int line, const char* func, Level level,
+                const char* message) {
+    char payload[3 * max_message$];
+    Uint32 size = 0;
+    const char* parts[3] = { file ? file : "", func ? func : "", message };
+    for (int i = 0; i < 3; ++i) {
+      Uint32 length = strlen(parts[i]);
+      if (length >= (Uint32)max_message$)
+        length = max_message$ - 1;
+      memcpy(payload + size, parts[i], length);
+      size += length;
+      payload[size++] = 0;
+    }
+    Record record = { 0, line, level, NULL, NULL, NULL };
+    return Push(record, payload, size);
+  }
+
+  // One printf conversion. Integers are kept as 64-bit values and printed
+  // with the "ll" length, the rest keep their own type.
+  struct Conversion {
+    char spec[32];    // Conversion with flags, without width or precision
+    const char* end;  // Format character after the conversion
+    char type;        // Conversion character
+    bool is_unsigned;
+    bool star_width;
+    bool star_precision;
+  };
+
+  // Parse the conversion starting at the '%' at p. Returns false for
+  // conversions that cannot be deferred.
+  bool ParseConversion(const char* p, Conversion& c, int& length) {
+    int n = 0;
+    c.spec[n++] = *p++;
+    c.star_width = c.star_precision = false;
+    while (*p && strchr("-+ #0", *p) && n < 8)
+      c.spec[n++] = *p++;
+    if (*p == '*') {
+      c.star_width = true;
+      c.spec[n++] = *p++;
+    } else
+      while (*p >= '0' && *p <= '9' && n < 16)
+        c.spec[n++] = *p++;
+    if (*p == '.') {
+      c.spec[n++] = *p++;
+      if (*p == '*') {
+        c.star_precision = true;
+        c.spec[n++] = *p++;
+      } else
+        while (*p >= '0' && *p <= '9' && n < 24)
+          c.spec[n++] = *p++;
+    }
+
+    // Length modifier: 0 int, 1 long, 2 long long, 3 size_t
+    length = 0;
+    if (*p == 'h') {
+      while (*p == 'h')
+        ++p;
+    } else if (*p == 'l') {
+      length = 1;
+      if (*++p == 'l') {
+        length = 2;
+        ++p;
+      }
+    } else if (*p == 'z') {
+      length = 3;
+      ++p;
+    } else if (*p == 'L' || *p == 'j' || *p == 't')
+      return false;
+    c.type = *p;
+    c.is_unsigned = *p && strchr("uxXo", *p);
+    if (!*p || !strchr("diuxXocfFeEgGaAsp%", *p))
+      return false;
+    if (*p && strchr("diuxXo", *p)) {
+      c.spec[n++] = 'l';
+      c.spec[n++] = 'l';
+    }
+    c.spec[n++] = *p;
+    c.spec[n] = 0;
+    c.end = p + 1;
+    return true;
+  }
+
+  // Copy the arguments of a printf-style call into a buffer, following the
+  // format string. Strings are copied, everything else is a fixed size.
+  // Returns the bytes used, or -1 if the arguments do not fit or the format
+  // cannot be deferred.
+  int PackArgs(char* buf, int size, const char* fmt, va_list va) {
+    int used = 0;
+    for (const char* p = strchr(fmt, '%'); p; p = strchr(p, '%')) {
+      Conversion c;
+      int length;
+      if (!ParseConversion(p, c, length))
+        return -1;
+      p = c.end;
+      if (c.type == '%')
+        continue;
+      if (used + 32 > size)
+        return -1;
+      if (c.star_width) {
+        Sint64 value = va_arg(va, int);
+        memcpy(buf + used, &value, 8);
+        used += 8;
+      }
+      if (c.star_precision) {
+        Sint64 value = va_arg(va, int);
+        memcpy(buf + used, &value, 8);
+        used += 8;
+      }
+      if (c.type == 's') {
+        const char* s = va_arg(va, const char*);
+        if (!s)
+          s = "(null)";
+        int n = strlen(s) + 1;
+        if (used + n > size)
+          return -1;
+        memcpy(buf + used, s, n);
+        used += n;
+        continue;
+      }
+      Uint64 value;
+      if (strchr("fFeEgGaA", c.type)) {
+        double d = va_arg(va, double);
+        memcpy(&value, &d, 8);
+      } else if (c.type == 'p')
+        value = (size_t)va_arg(va, void*);
+      else if (c.type == 'c')
+        value = va_arg(va, int);
+      else if (length == 3)
+        value = va_arg(va, size_t);
+      else if (length == 2)
+        value = c.is_unsigned ? va_arg(va, unsigned long long)
+                              : va_arg(va, long long);
+      else if (length == 1)
+        value = c.is_unsigned ? va_arg(va, unsigned long)
+                              : (Uint64)va_arg(va, long);
+      else
+        value = c.is_unsigned ? va_arg(va, unsigned int)
+                              : (Uint64)va_arg(va, int);
+      memcpy(buf + used, &value, 8);
+      used += 8;
+    }
+    return used;
+  }
+
+  // Format a deferred message from its packed arguments
+  void UnpackArgs(std::string& out, const char* fmt, const char* args) {
+    const char* p = fmt;
+    for (const char* q = strchr(p, '%'); q; q = strchr(p, '%')) {
+      out.append(p, q - p);
+      Conversion c;
+      int length;
+      ParseConversion(q, c, length);
+      p = c.end;
+      if (c.type == '%') {
+        out += '%';
+        continue;
+      }
+      int star[2], stars = 0;
+      Sint64 value;
+      if (c.star_width) {
+        memcpy(&value, args, 8);
+        star[stars++] = value;
+        args += 8;
+      }
+      if (c.star_precision) {
+        memcpy(&value, args, 8);
+        star[stars++] = value;
+        args += 8;
+      }
+      char buf[max_message$];
+      if (c.type == 's') {
+        if (stars == 2)
+          snprintf(buf, sizeof(buf), c.spec, star[0], star[1], args);
+        else if (stars == 1)
+          snprintf(buf, sizeof(buf), c.spec, star[0], args);
+        else
+          snprintf(buf, sizeof(buf), c.spec, args);
+        args += strlen(args) + 1;
+        out += buf;
+        continue;
+      }
+      Uint64 bits;
+      memcpy(&bits, args, 8);
+      args += 8;
+
+      // Expand the stars into the conversion so there is one argument
+      if (stars) {
+        std::string spec;
+        int next = 0;
+        for (const char* s = c.spec; *s; ++s)
+          if (*s == '*') {
+            char number[16];
+            snprintf(number, sizeof(number), "%d", star[next++]);
+            spec += number;
+          } else
+            spec += *s;
+        snprintf(c.spec, sizeof(c.spec), "%s", spec.c_str());
+      }
+      if (strchr("fFeEgGaA", c.type)) {
+        double d;
+        memcpy(&d, &bits, 8);
+        snprintf(buf, sizeof(buf), c.spec, d);
+      } else if (c.type == 'p')
+        snprintf(buf, sizeof(buf), c.spec, (void*)(size_t)bits);
+      else if (c.type == 'c')
+        snprintf(buf, sizeof(buf), c.spec, (int)bits);
+      else if (c.is_unsigned)
+        snprintf(buf, sizeof(buf), c.spec, (unsigned long long)bits);
+      else
+        snprintf(buf, sizeof(buf), c.spec, (long long)bits);
+      out += buf;
+    }
+    out += p;
+  }
+
+  // Report call sites that have had messages suppressed. Each site reports
+  // at most once an interval unless forced.
+  void ReportSuppressed(std::string& out, bool force) {
+    Uint32 now = SDL_GetTicks();
+    for (Site* site = sites$; site; site = site->next) {
+      if (!site->suppressed || (!force && now - site->reported < interval$))
+        continue;
+      site->reported = now;
+      int suppressed = __sync_lock_test_and_set(&site->suppressed, 0);
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%d similar messages suppressed",
+               suppressed);
+      Format(out, site->file, site->line, site->func, (Level)site->level,
+             buf);
+    }
+  }
+
+  // Write out everything queued on every ring. Only one thread drains at a
+  // time.
+  void Drain(bool force) {
+    std::string out;
+    char text[ring_size$ / 4];
+    for (Ring* ring = rings$; ring; ring = ring->next) {
+      Uint32 head = ring->head;
+      __sync_synchronize();
+      Uint32 tail = ring->tail;
+      while (tail != head) {
+        Record record;
+        RingRead(ring, tail, &record, sizeof(record));
+        RingRead(ring, tail + sizeof(record), text,
+                 record.size - sizeof(record));
+        tail += record.size;
+        if (record.fmt) {
+          std::string message;
+          UnpackArgs(message, record.fmt, text);
+          Format(out, record.file, record.line, record.func,
+                 (Level)record.level, message.c_str());
+          continue;
+        }
+        const char* file = text;
+        const char* func = file + strlen(file) + 1;
+        const char* message = func + strlen(func) + 1;
+        Format(out, file, record.line, func, (Level)record.level, message);
+      }
+
+      // The space is handed back only after the records are read
+      __sync_synchronize();
+      ring->tail = tail;
+      int dropped = __sync_lock_test_and_set(&ring->dropped, 0);
+      if (dropped) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%d log messages dropped", dropped);
+        Format(out, NULL, 0, NULL, LEVEL_WARN, buf);
+      }
+    }
+    ReportSuppressed(out, force);
+    if (!out.empty()) {
+      fwrite(out.data(), out.size(), 1, stderr);
+      fflush(stderr);
+    }
+  }
+
+  // Writer thread body, drains the rings in batches
+  int Writer(void*) {
+    while (!quit$) {
+      Flush();
+      SDL_Delay(writer_msec$);
+    }
+    return 0;
+  }
+}
+
+bool Site::Allow(const char* site_file, int site_line, const char* site_func,
+                 Level site_level) {
+  if (burst$ <= 0)
+    return true;
+
+  // Counting is not exact when several threads share a site, which only
+  // makes the limit a little loose
+  Uint32 now = SDL_GetTicks();
+  if (now - window >= interval$) {
+    window = now;
+    count = 0;
+  }
+  if (++count <= burst$)
+    return true;
 
-    return 1;
+  // The writer reports the site from the list of suppressing sites
+  if (!__sync_lock_test_and_set(&listed, 1)) {
+    file = site_file;
+    line = site_line;
+    func = site_func;
+    level = site_level;
+    reported = now;
+    do {
+      next = sites$;
+    } while (!__sync_bool_compare_and_swap(&sites$, next, this));
   }
+  __sync_fetch_and_add(&suppressed, 1);
+  return false;
+}
 
+void set_rate_limit(int burst, int interval_msec) {
+  burst$ = burst;
+  interval$ = interval_msec;
 }
 
 void set_program_name(const char* value) { program_name$ = value; }
@@ -85,10 +500,56 @@ void set_debug(bool value) { debug$ = value; }
 void set_color(bool value) { color$ = value; }
 void set_detail(int flags) { detail$ = flags; }
 
+void Start() {
+  if (running$)
+    return;
+  if (!drain_mutex$)
+    drain_mutex$ = SDL_CreateMutex();
+  quit$ = false;
+  if (!drain_mutex$ || !(writer$ = SDL_CreateThread(Writer, NULL)))
+    return;
+  running$ = true;
+}
+
+void Stop() {
+  if (!running$)
+    return;
+  running$ = false;
+  quit$ = true;
+  SDL_WaitThread(writer$, NULL);
+  writer$ = NULL;
+
+  // Report everything suppressed so far
+  SDL_mutexP(drain_mutex$);
+  Drain(true);
+  SDL_mutexV(drain_mutex$);
+}
+
+void Flush() {
+  if (!drain_mutex$)
+    return;
+  SDL_mutexP(drain_mutex$);
+  Drain(false);
+  SDL_mutexV(drain_mutex$);
+}
+
 void Print(const char* file, int line, const char* func,
            Level level, const char* string) {
-  if (PrintStart(file, line, func, level))
-    fprintf(stderr, "%s\n%s", string, ColorCode(-1,-1));
+
+  // No debug prints unless debug mode is on
+  if (level == LEVEL_DEBUG && !debug$)
+    return;
+
+  // Errors and messages logged while there is no writer thread are written
+  // right away, after anything still queued
+  if (level != LEVEL_ERROR && running$) {
+    PushText(file, line, func, level, string);
+    return;
+  }
+  Flush();
+  std::string out;
+  Format(out, file, line, func, level, string);
+  fputs(out.c_str(), stderr);
 
   // Errors are fatal
   if (level == LEVEL_ERROR)
@@ -97,14 +558,11 @@ void Print(const char* file, int line, const char* func,
 
 void Printv(const char* file, int line, const char* func,
             Level level, const char* fmt, va_list va) {
-  if (PrintStart(file, line, func, level)) {
-    vfprintf(stderr, fmt, va);
-    fprintf(stderr, "\n%s", ColorCode(-1,-1));
-  }
-
-  /// Errors are fatal
-  if (level == LEVEL_ERROR)
-    abort();
+  if (level == LEVEL_DEBUG && !debug$)
+    return;
+  char buf[max_message$];
+  vsnprintf(buf, sizeof(buf), fmt, va);
+  Print(file, line, func, level, buf);
 }
 
 void Printf(const char* file, int line, const char* func,
@@ -115,6 +573,29 @@ void Printf(const char* file, int line, const char* func,
   va_end(va);
 }
 
+void Queue(const char* file, int line, const char* func,
+           Level level, const char* fmt, ...) {
+  if (level == LEVEL_DEBUG && !debug$)
+    return;
+  va_list va;
+  va_start(va, fmt);
+  if (level != LEVEL_ERROR && running$) {
+    char args[max_message$];
+    va_list copy;
+    va_copy(copy, va);
+    int size = PackArgs(args, sizeof(args), fmt, copy);
+    va_end(copy);
+    if (size >= 0) {
+      Record record = { 0, line, level, fmt, file, func };
+      Push(record, args, size);
+      va_end(va);
+      return;
+    }
+  }
+  Printv(file, line, func, level, fmt, va);
+  va_end(va);
+}
+
 void Assert(const char* file, int line, const char* func,
             int statement, const char* string) {
   if (!statement)
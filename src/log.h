@@ -18,6 +18,7 @@ namespace log {
 /** Log event severity */
 typedef enum {
   LEVEL_DEBUG, ///< Only shown in debug mode
+  LEVEL_INFO,  ///< Informational message, always shown
   LEVEL_WARN,  ///< Non-fatal warning message
   LEVEL_ERROR, ///< Fatal error message (aborts)
 } Level;
@@ -29,6 +30,35 @@ enum {
   DETAIL_FUNC = 4, ///< Print function
 };
 
+/** True if debug prints are shown. DEBUG() checks this before evaluating
+    its arguments. */
+extern bool debug$;
+
+/** Rate limit state for one WARN() or DEBUG() call site. Sites have no
+    constructor so that the static in each macro needs no guard. */
+struct Site {
+
+  /** Returns true if the site may log now. Each site logs at most a burst
+      of messages per interval, the rest are counted and reported later as
+      suppressed. */
+  bool Allow(const char* file, int line, const char* func, Level level);
+
+  Uint32 window;
+  Uint32 reported;
+  int count;
+  int suppressed;
+  int listed;
+  int line;
+  int level;
+  const char* file;
+  const char* func;
+  Site* next;
+};
+
+/** Set the number of messages each call site may log per interval. A burst
+    of zero turns rate limiting off. */
+void set_rate_limit(int burst, int interval_msec);
+
 /** Display program name prefix */
 void set_program_name(const char* value);
 
@@ -41,6 +71,18 @@ void set_color(bool value);
 /** Set print-out detail */
 void set_detail(int flags);
 
+/** Start the writer thread. From then on messages other than errors are
+    queued on a buffer for the calling thread and written out in batches,
+    so logging does not wait on the terminal. Messages logged before this
+    or after Stop() are written right away. */
+void Start();
+
+/** Stop the writer thread after writing out all queued messages */
+void Stop();
+
+/** Write out all queued messages now */
+void Flush();
+
 /** Function to print to log */
 void Print(const char *file, int line, const char* func,
            Level level, const char *string);
@@ -49,6 +91,14 @@ void Printv(const char *file, int line, const char* func,
 void Printf(const char *file, int line, const char* func,
             Level level, const char *fmt, ...);
 
+/** Log a message with formatting deferred to the writer thread. The call
+    site, the format pointer and a copy of the arguments are queued, so the
+    format, file and function must be string literals. Formats that cannot
+    be deferred, errors and messages without a writer thread are formatted
+    right away. */
+void Queue(const char *file, int line, const char* func,
+           Level level, const char *fmt, ...);
+
 /** Assertion function */
 void Assert(const char *file, int line, const char* func,
             int statement, const char* string);
@@ -103,8 +153,12 @@ protected:
 
 // Convenience macros
 #define WARN(fmt, ...) \
-  dragoon::log::Printf(__FILE__, __LINE__, __func__, \
-                       dragoon::log::LEVEL_WARN, fmt, ## __VA_ARGS__)
+  do { \
+    static dragoon::log::Site site; \
+    if (site.Allow(__FILE__, __LINE__, __func__, dragoon::log::LEVEL_WARN)) \
+      dragoon::log::Queue(__FILE__, __LINE__, __func__, \
+                          dragoon::log::LEVEL_WARN, fmt, ## __VA_ARGS__); \
+  } while (0)
 #define ERROR(fmt, ...) \
   throw dragoon::log::Exception(__FILE__, __LINE__, __func__, \
                                 dragoon::log::LEVEL_ERROR, fmt, ## __VA_ARGS__)
@@ -112,8 +166,13 @@ protected:
 #define ASSERT(s) \
   dragoon::log::Assert(__FILE__, __LINE__, __func__, (int)(s), #s)
 #define DEBUG(fmt, ...) \
-  dragoon::log::Printf(__FILE__, __LINE__, __func__, \
-                       dragoon::log::LEVEL_DEBUG, fmt, ## __VA_ARGS__)
+  do { \
+    static dragoon::log::Site site; \
+    if (dragoon::log::debug$ && \
+        site.Allow(__FILE__, __LINE__, __func__, dragoon::log::LEVEL_DEBUG)) \
+      dragoon::log::Queue(__FILE__, __LINE__, __func__, \
+                          dragoon::log::LEVEL_DEBUG, fmt, ## __VA_ARGS__); \
+  } while (0)
 #else
 #define ASSERT(s)
 #define DEBUG(...)
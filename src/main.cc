@@ -12,8 +12,10 @@
 
 #include "log.h"
 #include "os.h"
+#include "prof.h"
 #include "ui.h"
 #include "input.h"
+#include "thread.h"
 #include "Mode.h"
 #include "Sprite.h"
 #include "Text.h"
@@ -33,7 +35,10 @@ namespace dragoon {
         already_ran = true;
 
         DEBUG("Cleaning up");
+        Timer::PrintFrameTimes();
         var::SaveConfig(config_name$.c_str());
+        thread::Cleanup();
+        log::Stop();
         SDL_Quit();
       } catch (log::Exception e) {
         e.Print();
@@ -57,6 +62,7 @@ int main(int argc, char* argv[]) {
     log::set_color(!WINDOWS);
     log::set_debug(CHECKED);
     log::set_detail(log::DETAIL_FILE | log::DETAIL_LINE | log::DETAIL_FUNC);
+    log::Start();
 
     DEBUG(PACKAGE_STRING);
     atexit(Cleanup);
@@ -64,8 +70,13 @@ int main(int argc, char* argv[]) {
 
     // Register variables
     var::Bool debug_prints("debug.prints");
+    var::Bool debug_bench("debug.bench");
     var::String edit_map("debug.edit");
     var::String play_map("debug.play");
+    var::Int log_burst("log.burst", 20);
+    var::Int log_interval("log.interval", 1000);
+    var::Int prof_capture("prof.capture", 120,
+                          "Frames captured to a trace file by F9");
 
     // Load variables
     config_name$ = os::UserDir();
@@ -73,6 +84,7 @@ int main(int argc, char* argv[]) {
     var::LoadConfig("data/defaults.cfg");
     var::LoadConfig(config_name$.c_str());
     var::ParseArgs(argc, argv);
+    log::set_rate_limit(log_burst, log_interval);
 
     // Test debug prints
     if (debug_prints) {
@@ -105,6 +117,10 @@ int main(int argc, char* argv[]) {
     SDL_WM_SetCaption(PACKAGE_STRING, PACKAGE);
     SDL_ShowCursor(SDL_DISABLE);
 
+    // Benchmark image processing
+    if (debug_bench)
+      Surface::BenchmarkDeseam();
+
     // Setup video mode, interface
     Mode::Set();
     ui::Init();
@@ -116,7 +132,7 @@ int main(int argc, char* argv[]) {
 
     // Test sprites
     Sprite::LoadConfig("data/test.cfg");
-    Sprite test_sprite("test");
+    Sprite test_sprite(SpriteId("test"));
 
     // Main loop
     DEBUG("Entering main loop");
@@ -134,6 +150,14 @@ int main(int argc, char* argv[]) {
           // In checked mode, Escape quits
           if (CHECKED && ev.key.keysym.sym == SDLK_ESCAPE)
             return 0;
+
+          // In checked mode, F8 prints frame time percentiles
+          if (CHECKED && ev.key.keysym.sym == SDLK_F8)
+            Timer::PrintFrameTimes();
+
+          // In checked mode, F9 captures a profiler trace
+          if (CHECKED && ev.key.keysym.sym == SDLK_F9)
+            prof::Capture(prof_capture);
         }
 
         // Window resized
@@ -165,15 +189,23 @@ int main(int argc, char* argv[]) {
         throttled.Reset();
         Mode::faces$.Reset();
         status.SetText(buf);
+        if (prof::enabled$)
+          prof::Print();
       }
 
+      // Reload files edited since the last frame
+      os::PollWatches();
+
       // Frame
-      Mode::Begin();
-      ui::Update();
-      test_sprite.Draw();
-      if (CHECKED)
-        status.Draw();
-      Mode::End();
+      {
+        PROFILE("Frame");
+        Mode::Begin();
+        ui::Update();
+        test_sprite.Draw();
+        if (CHECKED)
+          status.Draw();
+        Mode::End();
+      }
       Timer::Update();
     }
   } catch (log::Exception e) {
@@ -27,6 +27,36 @@ namespace os {
       directory exists after the call. */
   bool Mkdir(const char* path);
 
+  /** Returns the number of online processors */
+  int CpuCount();
+
+  /** Monotonic clock in nanoseconds, for timing code */
+  Uint64 Nanoseconds();
+
+  /** Modification time from a stat() result in nanoseconds, as precise as
+      the platform keeps it. Caches keyed on this see two saves within the
+      same second as different versions. */
+  Sint64 ModifiedTime(const struct stat& st);
+
+  /** Map a whole file into memory. The mapping is private, so writes to it
+      do not reach the file. Returns NULL if the file could not be mapped.
+   *  @param size   Set to the size of the mapping
+   */
+  void* MapFile(const char* filename, size_t* size);
+
+  /** Release memory returned by MapFile() */
+  void UnmapFile(void* data, size_t size);
+
+  /** Function called with the name of a watched file that changed */
+  typedef void (*WatchFunc)(const char* filename);
+
+  /** Call a function whenever a file is written. Files are only watched
+      where the platform supports it (inotify on Linux). */
+  void Watch(const char* filename, WatchFunc func);
+
+  /** Call the functions of watched files that changed since the last call */
+  void PollWatches();
+
   /** Set the callback function that handles Unix signals */
   void HandleSignals(void (*func)(int signal));
 
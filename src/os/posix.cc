@@ -12,6 +12,8 @@
 
 #include "../log.h"
 #if !WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
 
 namespace dragoon {
 namespace os {
@@ -40,6 +42,49 @@ const char *AppDir(void) {
   return PKGDATADIR;
 }
 
+int CpuCount() {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+
+Uint64 Nanoseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (Uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+Sint64 ModifiedTime(const struct stat& st) {
+#ifdef __APPLE__
+  return (Sint64)st.st_mtimespec.tv_sec * 1000000000 +
+         st.st_mtimespec.tv_nsec;
+#else
+  return (Sint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+void* MapFile(const char* filename, size_t* size) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  void* data = NULL;
+  if (!fstat(fd, &st) && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      WARN("Failed to map '%s': %s", filename, strerror(errno));
+      data = NULL;
+    } else
+      *size = st.st_size;
+  }
+  close(fd);
+  return data;
+}
+
+void UnmapFile(void* data, size_t size) {
+  if (data)
+    munmap(data, size);
+}
+
 void HandleSignals(void (*func)(int signal)) {
 
   // Ignore certain signals
@@ -0,0 +1,126 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "../os.h"
+#if defined(__linux__)
+#include <sys/inotify.h>
+
+namespace dragoon {
+namespace os {
+
+namespace {
+
+  // Watched file and the function to call when it changes
+  struct Entry {
+    std::string name;
+    std::string path;
+    WatchFunc func;
+  };
+
+  // Directories are watched rather than files, because editors often save
+  // by writing a new file and renaming it over the old one
+  std::map<std::string, int> dirs$;
+  std::map<int, std::vector<Entry> > watches$;
+
+  // Inotify descriptor, -1 before it is opened and -2 if that failed
+  int fd$ = -1;
+}
+
+void Watch(const char* filename, WatchFunc func) {
+  if (fd$ == -1 && (fd$ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    WARN("Failed to watch files: %s", strerror(errno));
+    fd$ = -2;
+  }
+  if (fd$ < 0)
+    return;
+
+  // Split the path into directory and file name
+  std::string path(filename);
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "."
+                    : path.substr(0, slash ? slash : 1);
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+
+  int wd;
+  std::map<std::string, int>::iterator it = dirs$.find(dir);
+  if (it != dirs$.end())
+    wd = it->second;
+  else {
+    wd = inotify_add_watch(fd$, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+      WARN("Failed to watch '%s': %s", dir.c_str(), strerror(errno));
+      return;
+    }
+    dirs$[dir] = wd;
+  }
+  std::vector<Entry>& entries = watches$[wd];
+  for (int i = 0; i < (int)entries.size(); ++i)
+    if (entries[i].name == name && entries[i].func == func)
+      return;
+  Entry entry = { name, path, func };
+  entries.push_back(entry);
+}
+
+void PollWatches() {
+  if (fd$ < 0)
+    return;
+
+  // Collect the changes first, a file written several times since the last
+  // poll is only reloaded once. Entries are copied because the callbacks
+  // may watch more files.
+  std::vector<Entry> changed;
+  union {
+    char bytes[4096];
+    inotify_event align;
+  } buf;
+  ssize_t length;
+  while ((length = read(fd$, buf.bytes, sizeof(buf))) > 0)
+    for (char* p = buf.bytes; p < buf.bytes + length;) {
+      const inotify_event* event = (const inotify_event*)p;
+      p += sizeof(inotify_event) + event->len;
+      std::map<int, std::vector<Entry> >::iterator it;
+      if (!event->len || (it = watches$.find(event->wd)) == watches$.end())
+        continue;
+      for (int i = 0; i < (int)it->second.size(); ++i) {
+        const Entry& entry = it->second[i];
+        if (entry.name != event->name)
+          continue;
+        bool seen = false;
+        for (int j = 0; !seen && j < (int)changed.size(); ++j)
+          seen = changed[j].path == entry.path && changed[j].func == entry.func;
+        if (!seen)
+          changed.push_back(entry);
+      }
+    }
+
+  for (int i = 0; i < (int)changed.size(); ++i) {
+    DEBUG("File '%s' changed", changed[i].path.c_str());
+    changed[i].func(changed[i].path.c_str());
+  }
+}
+
+} // namespace os
+} // namespace dragoon
+
+#else
+
+namespace dragoon {
+namespace os {
+
+// Files are not watched on other platforms
+void Watch(const char* filename, WatchFunc func) {}
+void PollWatches() {}
+
+} // namespace os
+} // namespace dragoon
+
+#endif
@@ -27,6 +27,50 @@ const char *AppDir(void) {
   return NULL;
 }
 
+int CpuCount() {
+  return 1;
+}
+
+Uint64 Nanoseconds() {
+  static LARGE_INTEGER frequency;
+  if (!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (Uint64)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+         (Uint64)(counter.QuadPart % frequency.QuadPart) * 1000000000 /
+         frequency.QuadPart;
+}
+
+Sint64 ModifiedTime(const struct stat& st) {
+  return (Sint64)st.st_mtime * 1000000000;
+}
+
+void* MapFile(const char* filename, size_t* size) {
+
+  // No mapping, just read the whole file in
+  FILE* file = fopen(filename, "rb");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  void* data = NULL;
+  if (length > 0 && (data = malloc(length))) {
+    fseek(file, 0, SEEK_SET);
+    if (fread(data, 1, length, file) != (size_t)length) {
+      free(data);
+      data = NULL;
+    } else
+      *size = length;
+  }
+  fclose(file);
+  return data;
+}
+
+void UnmapFile(void* data, size_t size) {
+  free(data);
+}
+
 void HandleSignals(void (*func)(int signal)) {}
 
 } // namespace dragoon
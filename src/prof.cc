@@ -0,0 +1,308 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "log.h"
+#include "os.h"
+#include "prof.h"
+#include "var.h"
+
+namespace dragoon {
+namespace prof {
+
+bool enabled$;
+
+namespace {
+  var::Bool enabled_var$("prof.enabled", false,
+                         "Time profiled zones and print them with the FPS");
+
+  // Zone IDs index fixed arrays, ID zero is never assigned. Zones past the
+  // limit and zones nested deeper than the stack are not timed.
+  const int max_zones$ = 256;
+  const int max_depth$ = 64;
+
+  // Times accumulated for one zone
+  struct Totals {
+    Uint64 total;
+    Uint64 self;
+    Uint64 calls;
+  };
+
+  // Zone currently open on a thread
+  struct Entry {
+    const char* name;
+    int id;
+    Uint64 start;
+    Uint64 child;
+  };
+
+  // Each thread times its zones into its own totals. Only the owning
+  // thread adds to them and EndFrame() swaps them out, so atomic adds are
+  // all that is needed.
+  struct Thread {
+    Entry stack[max_depth$];
+    Totals totals[max_zones$];
+    int depth;
+    int index;
+    Thread* next;
+  };
+
+  // Threads are added to the front of the list and never removed
+  Thread* volatile threads$;
+  __thread Thread* thread$;
+  volatile int thread_count$;
+  int main_thread$;
+
+  // Captured zone or counter. The buffer is allocated for the first capture
+  // and kept, events past its end are dropped.
+  struct Event {
+    const char* name;
+    Uint64 start;
+    Uint64 duration;
+    double value;
+    int thread;
+    char phase;
+  };
+
+  const int max_events$ = 1 << 17;
+  Event* events$;
+  volatile int event_count$;
+  volatile bool capturing$;
+  volatile int recording$;
+  Uint64 capture_start$;
+  int capture_left$;
+  int capture_pending$;
+  int capture_length$;
+
+  const char* volatile names$[max_zones$];
+  volatile int zone_count$;
+
+  // Totals of the last frame and of the frames since the last Print()
+  Totals frame$[max_zones$];
+  Totals sum$[max_zones$];
+  int frames$;
+
+  // Allocate and register the calling thread's buffers
+  Thread* CurrentThread() {
+    if (!thread$) {
+      Thread* thread = (Thread*)calloc(1, sizeof(Thread));
+      thread->index = __sync_add_and_fetch(&thread_count$, 1);
+      do {
+        thread->next = threads$;
+      } while (!__sync_bool_compare_and_swap(&threads$, thread->next, thread));
+      thread$ = thread;
+    }
+    return thread$;
+  }
+
+  // Assign a zone its ID. If two threads race, the loser's ID goes unused.
+  int Register(Zone& zone) {
+    int id = __sync_add_and_fetch(&zone_count$, 1);
+    if (id >= max_zones$)
+      id = -1;
+    else
+      names$[id] = zone.name;
+    __sync_bool_compare_and_swap(&zone.id, 0, id);
+    return zone.id;
+  }
+
+  // Add an event to the capture. Threads announce themselves in recording$
+  // before checking that the capture is still running, so once
+  // StopCapture() sees no recorders, nothing more is written to the buffer.
+  void Record(char phase, const char* name, int thread, Uint64 start,
+              Uint64 duration, double value) {
+    __sync_fetch_and_add(&recording$, 1);
+    int i;
+    if (capturing$ && (i = __sync_fetch_and_add(&event_count$, 1))
+                      < max_events$) {
+      Event& event = events$[i];
+      event.name = name;
+      event.start = start;
+      event.duration = duration;
+      event.value = value;
+      event.thread = thread;
+      event.phase = phase;
+    }
+    __sync_fetch_and_sub(&recording$, 1);
+  }
+
+  // End the capture and wait for threads still adding events
+  void StopCapture() {
+    capturing$ = false;
+    __sync_synchronize();
+    while (recording$)
+      SDL_Delay(0);
+  }
+
+  // Write a JSON string, escaping quotes, backslashes and control codes
+  void WriteString(FILE* file, const char* s) {
+    fputc('"', file);
+    for (; *s; ++s) {
+      if (*s == '"' || *s == '\\')
+        fprintf(file, "\\%c", *s);
+      else if ((unsigned char)*s < ' ')
+        fprintf(file, "\\u%04x", *s);
+      else
+        fputc(*s, file);
+    }
+    fputc('"', file);
+  }
+
+  // Write the captured events as a trace-event JSON file. Times are in
+  // microseconds from the start of the capture.
+  void WriteCapture() {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/trace-%ld.json", os::UserDir(),
+             (long)time(NULL));
+    FILE* file = fopen(path, "w");
+    if (!file) {
+      WARN("Failed to open '%s' for writing", path);
+      return;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (Thread* thread = threads$; thread; thread = thread->next)
+      fprintf(file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+              "\"tid\":%d,\"args\":{\"name\":\"%s %d\"}},\n",
+              thread->index, thread->index == main_thread$ ? "Main" : "Thread",
+              thread->index);
+    int count = event_count$ < max_events$ ? event_count$ : max_events$;
+    for (int i = 0; i < count; ++i) {
+      const Event& event = events$[i];
+      double ts = (Sint64)(event.start - capture_start$) * 1e-3;
+      fprintf(file, "{\"ph\":\"%c\",\"name\":", event.phase);
+      WriteString(file, event.name);
+      if (event.phase == 'C') {
+        fprintf(file, ",\"pid\":1,\"ts\":%.3f,\"args\":{", ts);
+        WriteString(file, event.name);
+        fprintf(file, ":%g}}", event.value);
+      } else
+        fprintf(file, ",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.thread, ts, event.duration * 1e-3);
+      fputs(i < count - 1 ? ",\n" : "\n", file);
+    }
+    fputs("]}\n", file);
+    fclose(file);
+    DEBUG("Wrote %d events from %d frames to '%s'", count, capture_length$,
+          path);
+    if (event_count$ > max_events$)
+      WARN("Capture buffer full, dropped %d events",
+           event_count$ - max_events$);
+  }
+
+  // Sort zones by self time, busiest first
+  bool CompareSelf(int a, int b) {
+    return sum$[a].self > sum$[b].self;
+  }
+}
+
+void Scope::Begin(Zone& zone) {
+  Thread* thread = CurrentThread();
+  if (thread->depth < max_depth$) {
+    Entry& entry = thread->stack[thread->depth];
+    entry.name = zone.name;
+    entry.id = zone.id ? zone.id : Register(zone);
+    entry.child = 0;
+    entry.start = os::Nanoseconds();
+  }
+  ++thread->depth;
+}
+
+void Scope::End() {
+  Uint64 now = os::Nanoseconds();
+  Thread* thread = thread$;
+  if (--thread->depth >= max_depth$)
+    return;
+  Entry& entry = thread->stack[thread->depth];
+  Uint64 elapsed = now - entry.start;
+  if (thread->depth > 0)
+    thread->stack[thread->depth - 1].child += elapsed;
+  if (capturing$)
+    Record('X', entry.name, thread->index, entry.start, elapsed, 0);
+  if (entry.id < 0)
+    return;
+  Totals& totals = thread->totals[entry.id];
+  __sync_fetch_and_add(&totals.total, elapsed);
+  __sync_fetch_and_add(&totals.self, elapsed - entry.child);
+  __sync_fetch_and_add(&totals.calls, 1);
+}
+
+void EndFrame() {
+  memset(frame$, 0, sizeof(frame$));
+  int count = zone_count$ < max_zones$ ? zone_count$ + 1 : max_zones$;
+  for (Thread* thread = threads$; thread; thread = thread->next)
+    for (int i = 1; i < count; ++i) {
+      Totals& totals = thread->totals[i];
+      if (!totals.calls)
+        continue;
+      frame$[i].total += __sync_lock_test_and_set(&totals.total, 0);
+      frame$[i].self += __sync_lock_test_and_set(&totals.self, 0);
+      frame$[i].calls += __sync_lock_test_and_set(&totals.calls, 0);
+    }
+  for (int i = 1; i < count; ++i) {
+    sum$[i].total += frame$[i].total;
+    sum$[i].self += frame$[i].self;
+    sum$[i].calls += frame$[i].calls;
+  }
+  ++frames$;
+
+  // Finish the running capture or start a pending one
+  if (capturing$ && --capture_left$ <= 0) {
+    StopCapture();
+    WriteCapture();
+  }
+  if (capture_pending$ > 0 && !capturing$) {
+    if (!events$)
+      events$ = (Event*)malloc(max_events$ * sizeof(Event));
+    main_thread$ = CurrentThread()->index;
+    event_count$ = 0;
+    capture_length$ = capture_left$ = capture_pending$;
+    capture_pending$ = 0;
+    capture_start$ = os::Nanoseconds();
+    __sync_synchronize();
+    capturing$ = true;
+  }
+  enabled$ = enabled_var$ || capturing$;
+}
+
+void Counter(const char* name, double value) {
+  if (capturing$)
+    Record('C', name, 0, os::Nanoseconds(), 0, value);
+}
+
+void Capture(int frames) {
+  if (capturing$ || frames < 1)
+    return;
+  DEBUG("Capturing %d frames", frames);
+  capture_pending$ = frames;
+}
+
+void Print() {
+  if (frames$ < 1)
+    return;
+  std::vector<int> ids;
+  int count = zone_count$ < max_zones$ ? zone_count$ + 1 : max_zones$;
+  for (int i = 1; i < count; ++i)
+    if (sum$[i].calls)
+      ids.push_back(i);
+  std::sort(ids.begin(), ids.end(), CompareSelf);
+  DEBUG("Profiled %d frames, msec per frame (self, total, calls):", frames$);
+  for (int i = 0; i < (int)ids.size() && i < 16; ++i) {
+    const Totals& totals = sum$[ids[i]];
+    DEBUG("%8.3f %8.3f %8.1f  %s", totals.self * 1e-6 / frames$,
+          totals.total * 1e-6 / frames$, (double)totals.calls / frames$,
+          names$[ids[i]]);
+  }
+  memset(sum$, 0, sizeof(sum$));
+  frames$ = 0;
+}
+
+} // namespace prof
+} // namespace dragoon
@@ -0,0 +1,78 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#pragma once
+
+namespace dragoon {
+namespace prof {
+
+/** True while zones are being timed, set from the prof.enabled variable at
+    the end of each frame. PROFILE() checks this before reading the clock. */
+extern bool enabled$;
+
+/** Named section of code. Zones have no constructor so that the static in
+    each PROFILE() needs no guard. The ID is assigned on first use. */
+struct Zone {
+  const char* name;
+  int id;
+};
+
+/** Times a zone from construction to destruction. Zones timed inside
+    another zone on the same thread are subtracted from its self time. */
+class Scope {
+public:
+  Scope(Zone& zone): active_(enabled$) {
+    if (active_)
+      Begin(zone);
+  }
+
+  ~Scope() {
+    if (active_)
+      End();
+  }
+
+private:
+  static void Begin(Zone& zone);
+  static void End();
+
+  bool active_;
+};
+
+/** Record a counter value in the capture, if one is running */
+void Counter(const char* name, double value);
+
+/** Record every zone, counter and frame for the given number of frames and
+    write them to a trace-event JSON file in the user directory, which trace
+    viewers such as chrome://tracing or Perfetto can open. Zones are timed
+    during the capture even if profiling is off. */
+void Capture(int frames);
+
+/** Collect the zone times of every thread into the last frame's totals
+    and write out the capture once it has all of its frames. Called once per
+    frame by Timer::Update(). */
+void EndFrame();
+
+/** Print the average time per frame spent in each zone since the last call,
+    busiest zones first */
+void Print();
+
+} // namespace prof
+} // namespace dragoon
+
+// Time the rest of the enclosing block as the named zone
+#define PROFILE_JOIN2(a, b) a ## b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE(name) \
+  static dragoon::prof::Zone PROFILE_JOIN(prof_zone_, __LINE__) = \
+    { name, 0 }; \
+  dragoon::prof::Scope PROFILE_JOIN(prof_scope_, __LINE__)( \
+    PROFILE_JOIN(prof_zone_, __LINE__))
@@ -0,0 +1,105 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "log.h"
+#include "str.h"
+
+namespace dragoon {
+namespace str {
+
+namespace {
+
+  // Open addressing table of interned strings with linear probing. Slots
+  // hold IDs, the capacity is a power of two and the table is kept at most
+  // half full.
+  class Table {
+  public:
+    Table(): slots_(256, -1) {}
+
+    ~Table() {
+      for (int i = 0; i < (int)names_.size(); ++i)
+        free(names_[i]);
+    }
+
+    int Find(const char* s, Uint32 hash) const {
+      return slots_[Probe(s, hash)];
+    }
+
+    int Intern(const char* s) {
+      Uint32 hash = Hash(s);
+      int slot = Probe(s, hash);
+      if (slots_[slot] >= 0)
+        return slots_[slot];
+      int id = names_.size();
+      names_.push_back(strdup(s));
+      hashes_.push_back(hash);
+      slots_[slot] = id;
+      if (2 * names_.size() > slots_.size())
+        Grow();
+      return id;
+    }
+
+    const char* Name(int id) const {
+      return id >= 0 && id < (int)names_.size() ? names_[id] : NULL;
+    }
+
+  private:
+
+    // Slot holding the string or the empty slot that ends its probe run
+    int Probe(const char* s, Uint32 hash) const {
+      int mask = slots_.size() - 1;
+      for (int i = hash & mask;; i = (i + 1) & mask) {
+        int id = slots_[i];
+        if (id < 0 || (hashes_[id] == hash && !strcmp(names_[id], s)))
+          return i;
+      }
+    }
+
+    void Grow() {
+      std::vector<int> slots(2 * slots_.size(), -1);
+      int mask = slots.size() - 1;
+      for (int id = 0; id < (int)names_.size(); ++id) {
+        int i = hashes_[id] & mask;
+        while (slots[i] >= 0)
+          i = (i + 1) & mask;
+        slots[i] = id;
+      }
+      slots_.swap(slots);
+    }
+
+    std::vector<int> slots_;
+    std::vector<char*> names_;
+    std::vector<Uint32> hashes_;
+  };
+
+  // Strings are interned by static variable constructors, so the table is
+  // created on first use rather than by static initialization
+  Table& Strings() {
+    static Table table;
+    return table;
+  }
+}
+
+int Intern(const char* s) {
+  return Strings().Intern(s);
+}
+
+int Find(const char* s, Uint32 hash) {
+  return Strings().Find(s, hash);
+}
+
+const char* Name(int id) {
+  return Strings().Name(id);
+}
+
+} // namespace str
+} // namespace dragoon
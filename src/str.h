@@ -29,5 +29,29 @@ namespace str {
     return false;
   }
 
+  /** Hashes a string. Inline so that the hash of a string literal is folded
+      into a constant by the compiler. */
+  static inline Uint32 Hash(const char* s) {
+    Uint32 hash = 2166136261u;
+    for (; *s; ++s)
+      hash = (hash ^ (Uint8)*s) * 16777619u;
+    return hash;
+  }
+
+  /** Returns the ID of an interned string, adding the string if it is new.
+      IDs are small consecutive integers starting at zero, so they can index
+      arrays. Strings are only interned from the main thread. */
+  int Intern(const char* s);
+
+  /** Returns the ID of a string with a precomputed hash, or -1 if it was
+      never interned */
+  int Find(const char* s, Uint32 hash);
+
+  /** Returns the ID of a string or -1 if it was never interned */
+  static inline int Find(const char* s) { return Find(s, Hash(s)); }
+
+  /** Returns the string for an interned ID */
+  const char* Name(int id);
+
 } // namespace dragoon
 } // namespace str
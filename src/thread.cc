@@ -0,0 +1,161 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#include "log.h"
+#include "os.h"
+#include "var.h"
+#include "thread.h"
+
+namespace dragoon {
+namespace thread {
+
+namespace {
+
+  // A range of work shared by the pool
+  struct Job {
+    RangeFunc func;
+    void* data;
+    int next;
+    int end;
+    int chunk;
+    int busy;
+  };
+
+  var::Int workers$("thread.workers", 0,
+                    "Worker threads for loading, 0 for one per CPU");
+  std::vector<SDL_Thread*> threads$;
+  SDL_mutex* mutex$;
+  SDL_cond* wake$;
+  SDL_cond* done$;
+  Job* job$;
+  int generation$;
+  bool started$;
+  bool quit$;
+  __thread bool worker$;
+
+  // Claim chunks of the job until it runs out
+  void Work(Job* job) {
+    for (;;) {
+      int first = __sync_fetch_and_add(&job->next, job->chunk);
+      if (first >= job->end)
+        break;
+      int last = first + job->chunk;
+      job->func(first, last < job->end ? last : job->end, job->data);
+    }
+  }
+
+  // Worker thread body, sleeps until a new job is posted
+  int Worker(void*) {
+    worker$ = true;
+    SDL_mutexP(mutex$);
+    int seen = generation$;
+    for (;;) {
+      while (!quit$ && seen == generation$)
+        SDL_CondWait(wake$, mutex$);
+      if (quit$)
+        break;
+      seen = generation$;
+
+      // The job may already be finished and gone by the time we wake up
+      Job* job = job$;
+      if (!job)
+        continue;
+      ++job->busy;
+      SDL_mutexV(mutex$);
+      Work(job);
+      SDL_mutexP(mutex$);
+      if (!--job->busy)
+        SDL_CondSignal(done$);
+    }
+    SDL_mutexV(mutex$);
+    return 0;
+  }
+
+  // Start worker threads on first use
+  void Start() {
+    if (started$)
+      return;
+    started$ = true;
+    int n = workers$ > 0 ? (int)workers$ : os::CpuCount();
+    if (n > 64)
+      n = 64;
+    mutex$ = SDL_CreateMutex();
+    wake$ = SDL_CreateCond();
+    done$ = SDL_CreateCond();
+    for (int i = 1; i < n; ++i) {
+      SDL_Thread* thread = SDL_CreateThread(Worker, NULL);
+      if (!thread) {
+        WARN("Failed to create worker thread: %s", SDL_GetError());
+        break;
+      }
+      threads$.push_back(thread);
+    }
+    DEBUG("Started %d worker threads", (int)threads$.size());
+  }
+}
+
+void Parallel(int begin, int end, int chunk, RangeFunc func, void* data) {
+  if (end <= begin)
+    return;
+  if (chunk < 1)
+    chunk = 1;
+  Start();
+
+  // Small ranges and nested calls are not worth waking the pool for
+  Job job = { func, data, begin, end, chunk, 0 };
+  bool post = false;
+  if (!worker$ && end - begin > chunk && threads$.size()) {
+    SDL_mutexP(mutex$);
+    if (!job$) {
+      job$ = &job;
+      ++generation$;
+      post = true;
+      SDL_CondBroadcast(wake$);
+    }
+    SDL_mutexV(mutex$);
+  }
+  Work(&job);
+  if (!post)
+    return;
+
+  // Wait for workers still finishing their last chunk
+  SDL_mutexP(mutex$);
+  while (job.busy)
+    SDL_CondWait(done$, mutex$);
+  job$ = NULL;
+  SDL_mutexV(mutex$);
+}
+
+int count() {
+  Start();
+  return threads$.size() + 1;
+}
+
+void Cleanup() {
+  if (!started$)
+    return;
+  SDL_mutexP(mutex$);
+  quit$ = true;
+  SDL_CondBroadcast(wake$);
+  SDL_mutexV(mutex$);
+  for (int i = 0; i < (int)threads$.size(); ++i)
+    SDL_WaitThread(threads$[i], NULL);
+  threads$.clear();
+  SDL_DestroyCond(done$);
+  SDL_DestroyCond(wake$);
+  SDL_DestroyMutex(mutex$);
+  started$ = false;
+  quit$ = false;
+}
+
+} // namespace thread
+} // namespace dragoon
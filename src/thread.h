@@ -0,0 +1,35 @@
+/******************************************************************************\
+ Dragoon - Copyright (C) 2010 - Michael Levin
+
+ This program is free software; you can redistribute it and/or modify it under
+ the terms of the GNU General Public License as published by the Free Software
+ Foundation; either version 2, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful, but WITHOUT
+ ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+\******************************************************************************/
+
+#pragma once
+
+namespace dragoon {
+namespace thread {
+
+/** Function run by the worker pool on the index range [first, last) */
+typedef void (*RangeFunc)(int first, int last, void* data);
+
+/** Split the index range [begin, end) into chunks of \c chunk indices and
+    run them on the worker pool. The calling thread works on chunks too and
+    the call returns once every chunk has finished. Calls made from inside a
+    worker or while another range is running are run on the calling thread. */
+void Parallel(int begin, int end, int chunk, RangeFunc func, void* data);
+
+/** Returns the number of threads that work on a parallel range, including
+    the calling thread */
+int count();
+
+/** Stop the worker threads */
+void Cleanup();
+
+} // namespace thread
+} // namespace dragoon
@@ -11,6 +11,8 @@
 \******************************************************************************/
 
 #include "log.h"
+#include "os.h"
+#include "str.h"
 #include "Config.h"
 #include "var.h"
 
@@ -18,9 +20,18 @@ namespace dragoon {
 namespace var {
 
 namespace {
-  typedef std::map<std::string, String*> variables$T;
 
-  ptr::Scope<variables$T> variables$;
+  // Variables indexed by the interned ID of their name. Variables are
+  // static objects in other files, so the vector is created by the first
+  // one to be constructed rather than by static initialization.
+  std::vector<String*>& Variables() {
+    static std::vector<String*> variables;
+    return variables;
+  }
+
+  bool Less(String* a, String* b) {
+    return strcmp(a->name(), b->name()) < 0;
+  }
 
   bool CheckBool(const char* s) {
     return !strcasecmp(s, "yes") || !strcasecmp(s, "true");
@@ -28,26 +39,33 @@ namespace {
 }
 
 String::String(const char* name, const char* value, const char* comment):
-  name_(name), comment_(comment), string_(NULL)
+  name_(name), comment_(comment), string_(NULL), id_(str::Intern(name))
 {
-  if (!variables$)
-    variables$ = new variables$T();
-  std::string name_string(name);
-  if (variables$->count(name_string) > 0)
+  std::vector<String*>& variables = Variables();
+  if (id_ >= (int)variables.size())
+    variables.resize(id_ + 1);
+  if (variables[id_])
     ERROR("Redeclared variable '%s'", name);
-  (*variables$)[name_string] = this;
+  variables[id_] = this;
   *this = value;
   string_default_ = string_ ? strdup(string_) : NULL;
 }
 
 String::~String() {
-  if (variables$)
-    variables$->erase(std::string(name_));
+  std::vector<String*>& variables = Variables();
+  if (variables[id_] == this)
+    variables[id_] = NULL;
   Clear();
 }
 
 String* Get(const char* name) {
-  return variables$->count(name) > 0 ? (*variables$)[name] : NULL;
+  return Get(name, str::Hash(name));
+}
+
+String* Get(const char* name, Uint32 hash) {
+  int id = str::Find(name, hash);
+  std::vector<String*>& variables = Variables();
+  return id >= 0 && id < (int)variables.size() ? variables[id] : NULL;
 }
 
 void String::Clear() {
@@ -171,6 +189,7 @@ void LoadConfig(const char* path) {
     else if (n->size() < 2)
       WARN("%s:%d: No value assigned to variable '%s'", path, n->line(), name);
   }
+  os::Watch(path, LoadConfig);
 }
 
 void ParseArgs(int argc, char* argv[]) {
@@ -198,9 +217,13 @@ void SaveConfig(const char* path) {
         "############\n# Dragoon -- automatically generated configuration "
         "file\n##############################################################"
         "##################\n", f);
-  for (variables$T::iterator it = variables$->begin(), end = variables$->end();
-       it != end; ++it)
-    it->second->Write(f);
+  std::vector<String*> vars;
+  for (int i = 0; i < (int)Variables().size(); ++i)
+    if (Variables()[i])
+      vars.push_back(Variables()[i]);
+  std::sort(vars.begin(), vars.end(), Less);
+  for (int i = 0; i < (int)vars.size(); ++i)
+    vars[i]->Write(f);
   fclose(f);
   DEBUG("Saved configuration file '%s'", path);
 }
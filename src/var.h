@@ -12,6 +12,7 @@
 
 #pragma once
 #include "ptr.h"
+#include "str.h"
 
 namespace dragoon {
 namespace var {
@@ -43,11 +44,15 @@ public:
   /** Variables own their strings */
   virtual String& operator=(const char*);
 
+  /** Name used to fetch the variable */
+  const char* name() const { return name_; }
+
 protected:
   const char* name_;
   const char* comment_;
   char* string_;
   char* string_default_;
+  int id_;
 };
 
 /** Floating-point class for storing configuration-file variables */
@@ -126,6 +131,30 @@ typedef Int Bool;
 /** Gets a variable by name */
 String* Get(const char* name);
 
+/** Gets a variable by name with a hash precomputed by str::Hash() */
+String* Get(const char* name, Uint32 hash);
+
+/** Refers to a variable by name, looking it up only the first time it is
+    used. Handles can be declared before the variable itself exists. */
+class Handle {
+public:
+  Handle(const char* name): name_(name), hash_(str::Hash(name)), var_(NULL) {}
+
+  /** Returns the variable or NULL if there is none by this name yet */
+  String* get() {
+    if (!var_)
+      var_ = Get(name_, hash_);
+    return var_;
+  }
+
+  String* operator->() { return get(); }
+
+private:
+  const char* name_;
+  Uint32 hash_;
+  String* var_;
+};
+
 /** Loads a configuration file */
 void LoadConfig(const char* path);
 